@@ -25,13 +25,16 @@ lpm_node *root;
  */
 int cache;
 
+/* where the tree nodes live, refer lpm_compact.c */
+extern lpm_arena arena;
+extern pthread_mutex_t lpm_lock;
+
 
 /*
- * API to insert a prefix into the LPM tree.
- * refer lpm.h for details.
+ * Insert a prefix into the LPM tree, with a nexthop or a nexthop group.
  */
-int
-insert_prefix(int *prefix, int size, int nh_ip, int port) 
+static int
+lpm_insert(int *prefix, int size, int nh_ip, int port, nh_group *group) 
 {
     lpm_node *curr_node = NULL; //pointer to track the current node in the tree
     int is_leaf = 0; //leaf node will have valid nexthop and port info
@@ -41,7 +44,7 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
      */
      
     if (root == NULL || size < 1 || prefix == NULL ||
-        nh_ip < 0    || port < 0) {
+        (group == NULL && (nh_ip == -1 || port < 0))) {
         /* invalid input parameters */
         printf("Invalid parameter root 0x%p size %d, nh_ip %d, port %d\n",
                                                  root, size, nh_ip, port);
@@ -58,7 +61,9 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
     
     /*
      * WALK LPM TREE AND KEEP INSERTING THE NODES
+     * (locked against a compaction copying the tree)
      */
+    pthread_mutex_lock(&lpm_lock);
   
     /* point the current node at the root */
     curr_node = root;
@@ -66,15 +71,14 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
     for (int i=0; i<size; i++) {
     /* loop to walk and insert the prefix into the lpm tree */
     
+        /* the last node of the prefix holds the nexthop */
+        is_leaf = (i == size-1);
+        
         if (prefix[i] == 0) {
         /* goto the left */
             if (curr_node->left == NULL) {
             /* insert a new node */
-                lpm_node *new_node = calloc(1,sizeof(lpm_node));
-                if (new_node == NULL) {
-                    printf("calloc failed.\n");
-                    exit(0);
-                }
+                lpm_node *new_node = lpm_node_alloc();
                 new_node->left = NULL;
                 new_node->right = NULL;
                 curr_node->left = new_node;
@@ -95,11 +99,7 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
         /* goto the right */
             if (curr_node->right == NULL) {
             /* insert a new node */
-                lpm_node *new_node = calloc(1,sizeof(lpm_node));
-                if (new_node == NULL) {
-                    printf("calloc failed.\n");
-                    exit(0);
-                }
+                lpm_node *new_node = lpm_node_alloc();
                 new_node->left = NULL;
                 new_node->right = NULL;
                 curr_node->right = new_node;
@@ -118,15 +118,50 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
             } 
         }
         
-        if (i == size-2) {
-            is_leaf = 1;
-        }
-        
     } //end of for loop - walking the prefix
     
+    /* attach the nexthop group, release the one the route used before */
+    if (curr_node->group != group) {
+        if (curr_node->group != NULL) {
+            curr_node->group->refcnt--;
+        }
+        if (group != NULL) {
+            group->refcnt++;
+        }
+        curr_node->group = group;
+    }
+    
+    lpm_compact_note(prefix, size);
+    pthread_mutex_unlock(&lpm_lock);
+    
     return EOK;
 }
 
+/*
+ * API to insert a prefix into the LPM tree.
+ * refer lpm.h for details.
+ */
+int
+insert_prefix(int *prefix, int size, int nh_ip, int port) 
+{
+    return lpm_insert(prefix, size, nh_ip, port, NULL);
+}
+
+/*
+ * API to insert a prefix that uses a nexthop group.
+ * refer lpm.h for details.
+ */
+int
+insert_prefix_nhg(int *prefix, int size, nh_group *group)
+{
+    if (group == NULL) {
+        printf("Invalid parameter group %p\n", group);
+        return EINVAL;
+    }
+    
+    return lpm_insert(prefix, size, NH_GROUP, group->id, group);
+}
+
 /*
  * API to delete a prefix from the LPM tree.
  * refer lpm.h for details.
@@ -134,40 +169,63 @@ insert_prefix(int *prefix, int size, int nh_ip, int port)
 lpm_node *
 delete_prefix(lpm_node *root, int *prefix, int size) 
 {
-    if (size < 0 || root == NULL) {
-        return NULL;
+    lpm_node *path[MAX_DEPTH+1];    //nodes from the root to the leaf
+    lpm_node *curr_node = NULL;
+    int depth = 0;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (root == NULL || prefix == NULL || size < 1 || size > MAX_DEPTH) {
+        printf("Invalid parameter root 0x%p prefix %p size %d\n",
+                                           root, prefix, size);
+        return root;
     }
 
-    /* DFS to the leaf node */
-    if (prefix[0] == 0) {
-        root->left = delete_prefix(root->left, prefix+1, size-1);
-        if(size == 0) {
-        /* reset the leaf node with child */
-            root->nexthop = -1;
-            root->src_port = -1;
+    pthread_mutex_lock(&lpm_lock);
+
+    /* walk to the leaf node */
+    path[0] = root;
+    for (depth=0; depth<size; depth++) {
+        if (prefix[depth] == 0) {
+            curr_node = path[depth]->left;
+        } else {
+            curr_node = path[depth]->right;
         }
-    } else {
-        root->right = delete_prefix(root->right, prefix+1, size-1);
-        if(size == 0) {
-        /* reset the leaf node with child */
-            root->nexthop = -1;
-            root->src_port = -1;
+        if (curr_node == NULL) {
+        /* prefix not in the tree */
+            pthread_mutex_unlock(&lpm_lock);
+            return root;
         }
+        path[depth+1] = curr_node;
     }
-    
-    /* Delete the leaf node with no chidren */
-    if (root->left == NULL && root->right == NULL &&
-       ((root->nexthop == -1 && root->src_port == -1) || size == 0)) {
-        root->val = -1;
-        root->nexthop = -1;
-        root->src_port = -1;
-        root->left = NULL;
-        root->right = NULL;
-        root = NULL;
-        free (root);
-        return NULL;
+
+    /* reset the leaf node */
+    curr_node->nexthop = -1;
+    curr_node->src_port = -1;
+    if (curr_node->group != NULL) {
+        curr_node->group->refcnt--;
+        curr_node->group = NULL;
+    }
+
+    /* Delete the nodes with no nexthop and no children, bottom up */
+    for (depth=size; depth>0; depth--) {
+        curr_node = path[depth];
+        if (curr_node->left != NULL || curr_node->right != NULL ||
+            curr_node->nexthop != -1) {
+            break;
+        }
+        if (path[depth-1]->left == curr_node) {
+            path[depth-1]->left = NULL;
+        } else {
+            path[depth-1]->right = NULL;
+        }
+        lpm_node_free(curr_node);
     }
     
+    lpm_compact_note(prefix, size);
+    pthread_mutex_unlock(&lpm_lock);
+    
     return root;
 }
 
@@ -177,11 +235,23 @@ delete_prefix(lpm_node *root, int *prefix, int size)
  */
 int
 find_route(int *prefix, lkp_result* result) 
+{
+    /* routes with a nexthop group always use the first bucket */
+    return find_route_ecmp(prefix, 0, result);
+}
+
+/* 
+ * API to search a IP and select the nexthop of the flow
+ * refer lpm.h for details.
+ */
+int
+find_route_ecmp(int *prefix, unsigned int flow_hash, lkp_result *result) 
 {
     
     int default_nh = 2130706433;    //local host 127.0.0.1
     int default_port = 999;         //CPU port
     lpm_node *curr_node = NULL;
+    lpm_node *leaf = NULL;          //longest matched prefix
     
     /*
      * VERIFY INPUT DATA
@@ -206,7 +276,8 @@ find_route(int *prefix, lkp_result* result)
     curr_node = root;
     
     /*
-     * Walk the tree and keep updating the nh and port
+     * Walk the tree and keep updating the longest matched leaf,
+     * routes with an empty nexthop group do not match.
      */
     for (int i=0; i<MAX_DEPTH; i++) {
         if (prefix[i] == 0) {
@@ -215,11 +286,6 @@ find_route(int *prefix, lkp_result* result)
                 break;
             } else {
                 curr_node = curr_node->left;
-                if (curr_node->nexthop != -1) {
-                /* leaf node - update nh and port */
-                    default_nh = curr_node->nexthop;
-                    default_port = curr_node->src_port;
-                }
             }
         } else {
         /* goto the right */
@@ -227,13 +293,25 @@ find_route(int *prefix, lkp_result* result)
                 break;
             } else {
                 curr_node = curr_node->right;
-                if (curr_node->nexthop != -1) {
-                /* leaf node - update nh and port */
-                    default_nh = curr_node->nexthop;
-                    default_port = curr_node->src_port;
-                }      
             }
         }
+        if (curr_node->nexthop != -1 &&
+            (curr_node->group == NULL || curr_node->group->nmembers)) {
+        /* leaf node */
+            leaf = curr_node;
+        }
+    }
+    
+    /*
+     * update nh and port, from the group bucket of the flow if any
+     */
+    if (leaf != NULL && leaf->group != NULL) {
+        const nh_member *member = nhg_select(leaf->group, flow_hash);
+        default_nh = member->nexthop;
+        default_port = member->src_port;
+    } else if (leaf != NULL) {
+        default_nh = leaf->nexthop;
+        default_port = leaf->src_port;
     }
     
     /* 
@@ -291,6 +369,7 @@ add_delete_route(int add, lkp_result *result) {
     char nh[IPv4_SIZE];             //nexthop IPv4 address
     int nw_nh = 0;                  //decimal equivalent of nexthop address
     int port = 0;                   //egress source port
+    nh_group *group = NULL;         //nexthop group, if the nexthop is g<id>
     int prefix[MAX_DEPTH];          //binary equivalent of route 'bitwise AND' mask
     int size = 0;                   //final size of prefix array after bitwise AND
     int rc = 0;
@@ -316,10 +395,12 @@ add_delete_route(int add, lkp_result *result) {
     printf("Enter the network mask (1 to 32): ");
     scanf("%d",&mask);
     if (add) {
-        printf("Enter the IPv4 nextop ip: ");
+        printf("Enter the IPv4 nextop ip (or g<id> for a nexthop group): ");
         scanf("%s",nh);
-        printf("Enter the o/p port: ");
-        scanf("%d",&port);
+        if (nh[0] != 'g') {
+            printf("Enter the o/p port: ");
+            scanf("%d",&port);
+        }
     }
     
     /*
@@ -336,7 +417,13 @@ add_delete_route(int add, lkp_result *result) {
         printf("Invalid mask: %d\n",mask);
         return;
     }
-    if (add) {
+    if (add && nh[0] == 'g') {
+        group = nhg_find(atoi(nh+1));
+        if (group == NULL) {
+            printf("Invalid nexthop group: %s\n", nh);
+            return;
+        }
+    } else if (add) {
         if ( (rc = inet_pton(AF_INET, nh, &nw_nh)) == 0) {
             printf("Invalid IPv4 nexthop address: %s\n", nh);
             return;
@@ -363,7 +450,11 @@ add_delete_route(int add, lkp_result *result) {
     /* 
      * Insert the prefix into the LPM tree 
      */
-        rc = insert_prefix(prefix, mask, nw_nh, port);
+        if (group != NULL) {
+            rc = insert_prefix_nhg(prefix, mask, group);
+        } else {
+            rc = insert_prefix(prefix, mask, nw_nh, port);
+        }
         if(rc == EOK) {
             printf("IPv4 Route %s/%d added successfully.\n", ip, mask);
         } else {
@@ -379,6 +470,9 @@ add_delete_route(int add, lkp_result *result) {
     }
     
     (void)update_reg_ip(result);
+    
+    /* compact the tree in the background once the churn scattered it */
+    lpm_compact_check();
 }
 
 
@@ -453,28 +547,11 @@ register_ip(lkp_result *result) {
 }
 
 
-/*
- * Walk API to check the LPM tree.
- * Only for internal debugging.
- */
-void 
-walk(lpm_node *root) 
-{
-    if (root == NULL) {
-        return;
-    }
-    
-    printf("val %d nh %d port %d \n",
-            root->val, root->nexthop,
-            root->src_port);
-    walk(root->left);
-    walk(root->right);
-}
-
 int main()
 {
     
     lkp_result *result; //pointer to the cache data that has Registered IP info.
+    lkp6_result *result6; //pointer to the cache data that has Registered IPv6 info.
     char user_data;     //to check the action user wants to perform.
     
     /* initialize the LPM tree root */
@@ -486,13 +563,21 @@ int main()
         printf("calloc failed.\n");
         exit(0);
     }
+    result6 = (lkp6_result *) calloc( 1, sizeof(lkp6_result));
+    if (result6 == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
     
     /* 
      * wait for user input and perform requested operations.
      */
     while (1) {
+        /* swap in the compacted tree, no lookup is in progress here */
+        lpm_compact_poll();
+        
         fflush(stdin);
-        printf("\nEnter [a]dd route, [d]elete route or [r]egister: ");
+        printf("\nEnter [a]dd route, [d]elete route, [r]egister, [g]roup or [6] for IPv6: ");
         scanf("%c",&user_data);
         fflush(stdin);
 
@@ -517,9 +602,29 @@ int main()
                 printf("Source Port %d\n",result->sp);
                 break;
             
+            case 'g':
+            case 'G':
+                nhg_menu(result);
+                break;
+            
+            case '6':
+                ipv6_menu(result6);
+                break;
+            
             case 'W':
             /* hidden from user, only for internal debugging */
-                (void) walk(root);
+                (void) dump_routes(root);
+                break;
+            
+            case 'C':
+            /* hidden from user, compact the tree on demand */
+                (void) lpm_compact_start();
+                lpm_compact_report();
+                break;
+            
+            case 'T':
+            /* hidden from user, differential stress test of the engines */
+                stress_menu();
                 break;
             
             default: 
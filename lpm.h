@@ -6,6 +6,9 @@ Date: 08/Jan/2022
 
 *******************************************************************************/
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 //DELETE FROM HERE
 /*
  * GLOBAL DATA
@@ -15,8 +18,48 @@ Date: 08/Jan/2022
  #define EOK         0
  #define IPv4_SIZE  16
  #define MAX_DEPTH  32
+ #define IPv6_SIZE  46          //INET6_ADDRSTRLEN
+ #define IPv6_BYTES 16
+ #define MAX_DEPTH6 128
+ #define MBT_MAX_LEVELS 128     //one level per bit in the worst case
+ #define MBT_MAX_STRIDE 24      //widest stride a multibit node may use
+ #define STRIDE_BUDGET  (64 << 20)  //default memory budget of a tuned table
+ #define STRIDE_DRIFT   0.2     //histogram change that triggers a rebuild
+ #define STRIDE_MIN_CHANGES 32  //updates before the drift is checked
+ #define STRIDE_JOURNAL 4096    //updates kept while a rebuild is running
  #define TRUE        1
  #define FALSE       0
+ #define NH_GROUP   -2          //nexthop of a route that points to a nexthop group
+ #define NHG_BUCKETS 256        //resilient hashing buckets of a nexthop group
+ #define NHG_MAX_MEMBERS 64     //members of a nexthop group
+ #define COMPACT_MIN_NODES 1024 //smallest tree worth compacting
+ #define COMPACT_FRAG   0.25    //share of scattered nodes that triggers compaction
+ #define COMPACT_SLICE  1024    //nodes copied per hold of the update lock
+
+/*
+ * Member of a nexthop group
+ */
+typedef struct nh_member {
+    int nexthop;                //nexthop address (host byte order)
+    int src_port;               //source port
+} nh_member;
+
+/*
+ * Equal cost nexthop group.
+ *
+ * A flow hash picks one of the buckets, every bucket is owned by a member,
+ * so selecting a member is a single array lookup. When a member joins or
+ * leaves, only the buckets it takes or owned change owner, the other flows
+ * keep their nexthop (resilient hashing).
+ */
+typedef struct nh_group {
+    int id;                             //group id, 1 and above
+    int nmembers;                       //number of members
+    int refcnt;                         //number of routes using the group
+    nh_member member[NHG_MAX_MEMBERS];
+    unsigned char bucket[NHG_BUCKETS];  //member owning each bucket
+    struct nh_group *next;              //next group in the list
+} nh_group;
 
 /* 
  * LPM tree nodes store route prefix
@@ -24,11 +67,27 @@ Date: 08/Jan/2022
 typedef struct lpm_node {
     int val;                    //either 0 or 1
     int nexthop;                //return value, valid only for leaf nodes else 0
+                                //NH_GROUP if the route uses a nexthop group
     int src_port;               //return value, valid only for leaf nodes else 0
+    nh_group *group;            //nexthop group of the route, NULL if none
     struct lpm_node *left;      //left node pointer
     struct lpm_node *right;     //right node pointer
 } lpm_node;
 
+/*
+ * Memory the LPM tree nodes live in.
+ *
+ * A compaction copies the live nodes into one contiguous slab, depth
+ * first, so a lookup path shares a few cache lines. Nodes inserted
+ * later come from the heap, slab nodes deleted later stay as holes.
+ */
+typedef struct lpm_arena {
+    lpm_node *slab;             //contiguous nodes of the last compaction
+    int slab_size;              //number of nodes in the slab
+    int slab_dead;              //slab nodes deleted since the compaction
+    int heap_nodes;             //live nodes outside of the slab
+} lpm_arena;
+
 /*
  * Structure that stores the registered ip
  */
@@ -39,6 +98,152 @@ typedef struct lkp_result {
     int sp;                     //source port from the lpm result
 } lkp_result;
 
+/*
+ * Structure that stores the registered IPv6 address
+ */
+typedef struct lkp6_result {
+    int registered;                     //TRUE once an address is registered
+    unsigned char last_ip[IPv6_BYTES];  //last registered ip
+    unsigned char nh[IPv6_BYTES];       //nexthop from the lpm result
+    int sp;                             //source port from the lpm result
+} lkp6_result;
+
+
+/*
+ * MULTIBIT TRIE
+ *
+ * Each level consumes 'stride' bits of the address, so a lookup costs one
+ * memory access per level instead of one per bit. Prefixes that do not end
+ * on a stride boundary are expanded into all the slots they cover
+ * (controlled prefix expansion); a slot always points at the longest
+ * prefix of its node that covers it.
+ */
+
+/*
+ * Original (unexpanded) route stored in a multibit trie.
+ * Addresses are kept in network byte order, IPv4 uses the first 4 bytes.
+ */
+typedef struct mbt_route {
+    unsigned char prefix[IPv6_BYTES];   //route prefix, host bits are 0
+    int len;                            //prefix length
+    unsigned char nexthop[IPv6_BYTES];  //nexthop address
+    int src_port;                       //egress source port
+} mbt_route;
+
+/*
+ * One slot of a multibit trie node
+ */
+typedef struct mbt_entry {
+    mbt_route *route;                   //longest prefix of this node covering the slot
+    struct mbt_node *child;             //next level, NULL if none
+} mbt_entry;
+
+typedef struct mbt_node {
+    int nchild;                         //number of non NULL child pointers
+    int nroutes;                        //number of routes ending in this node
+    int max_routes;                     //size of the routes array
+    mbt_route **routes;                 //routes ending in this node
+    mbt_entry entry[];                  //2^stride slots
+} mbt_node;
+
+typedef struct mbt_table {
+    int width;                          //address width in bits (32 or 128)
+    int nlevels;                        //number of strides
+    int stride[MBT_MAX_LEVELS];         //bits consumed at each level
+    int offset[MBT_MAX_LEVELS];         //first address bit of each level
+    mbt_node *root;
+    int nroutes;                        //number of routes in the table
+    int nnodes;                         //number of trie nodes
+    size_t mem;                         //bytes used by nodes and routes
+    int len_count[MAX_DEPTH6+1];        //number of routes per prefix length
+} mbt_table;
+
+/*
+ * Stride layout chosen for a multibit trie
+ */
+typedef struct stride_plan {
+    int nlevels;                        //number of strides
+    int stride[MBT_MAX_LEVELS];         //bits consumed at each level
+    int max_accesses;                   //levels needed by the longest prefix
+    double accesses;                    //levels walked per route, averaged
+    double mem;                         //estimated bytes of the trie
+} stride_plan;
+
+/*
+ * Update recorded while a table is rebuilt in the background
+ */
+typedef struct stride_update {
+    int add;                            //TRUE for add, FALSE for delete
+    mbt_route route;
+} stride_update;
+
+/*
+ * Keeps a multibit trie laid out for the prefix lengths it holds.
+ *
+ * When the prefix length histogram drifts from the one the layout was
+ * planned for, the number of routes doubles or halves, or the table
+ * outgrows its budget, a new layout is computed and the table rebuilt by a
+ * background thread from a snapshot of the routes. Updates made in the
+ * meantime are journaled and replayed before the new table is swapped in.
+ * If no layout fits the budget the smallest one is used when it beats the
+ * live one; the table is not replanned for the budget again until the
+ * number of routes moves by 1/16.
+ */
+typedef struct stride_tuner {
+    mbt_table **table;                  //live table, replaced on rebuild
+    size_t budget;                      //memory budget of the table
+    stride_plan plan;                   //layout of the live table
+    double hist[MAX_DEPTH6+1];          //prefix length share the plan is for
+    int planned;                        //number of routes the plan is for
+    int changes;                        //updates since the last plan
+    int over_budget;                    //TRUE if no layout fits the budget
+    atomic_int state;                   //STRIDE_IDLE, RUNNING or DONE
+    pthread_t thread;
+    mbt_route *snap;                    //routes the rebuild works on
+    int nsnap;
+    size_t snap_mem;                    //memory of the table at the snapshot
+    int width;
+    mbt_table *next;                    //rebuilt table
+    stride_plan next_plan;
+    stride_update journal[STRIDE_JOURNAL];
+    int njournal;                       //-1 when the journal overflowed
+} stride_tuner;
+
+ #define STRIDE_IDLE     0
+ #define STRIDE_RUNNING  1
+ #define STRIDE_DONE     2
+
+
+/*
+ * Route returned by the LPM tree iterator
+ */
+typedef struct lpm_route {
+    unsigned int prefix;        //route prefix (host byte order, host bits 0)
+    int len;                    //prefix length
+    int nexthop;                //nexthop address (host byte order)
+    int src_port;               //source port
+    int group;                  //nexthop group id, 0 if none
+} lpm_route;
+
+ #define LPM_ITER_ALL       0   //every route of the tree
+ #define LPM_ITER_SUBTREE   1   //a prefix and all its more specifics
+ #define LPM_ITER_COVERING  2   //the prefixes covering an address
+
+/*
+ * LPM tree iterator.
+ * The walk keeps the path from the root on a fixed size stack,
+ * so it neither recurses nor allocates.
+ */
+typedef struct lpm_iter {
+    lpm_node *stack[MAX_DEPTH+1];       //nodes on the path, indexed by depth
+    unsigned char state[MAX_DEPTH+1];   //next step of each node on the path
+    int depth;                          //depth of the current node
+    int base;                           //depth of the subtree the walk is limited to
+    int limit;                          //deepest prefix for LPM_ITER_COVERING
+    int mode;                           //LPM_ITER_ALL, SUBTREE or COVERING
+    unsigned int path;                  //bits of the current path
+} lpm_iter;
+
 
 /*
  * API DECLARATIONS
@@ -52,7 +257,8 @@ typedef struct lkp_result {
  *
  * Input: prefix    (pointer to an array, that will be updated into the tree)
  * Input: size      (size of the prefix array)
- * Input: nexthop   (nexthop data to be updated in the leaf node)
+ * Input: nexthop   (nexthop data to be updated in the leaf node,
+ *                   any address but 255.255.255.255 i.e. -1)
  * Input: port      (source port to be updated in the leaf node)
  *
  * Output: 0 - Success
@@ -64,18 +270,18 @@ insert_prefix(int *prefix, int size, int nexthop, int port);
 /*
  * This function deletes the prefix from the LPM tree.
  *
- * It recurssively does a Depth first walk to the leaf node 
- * and deletes the leaf nodes that are without any child.
+ * It walks to the leaf node keeping the path on a stack, then walks
+ * back up and deletes the nodes that are left without nexthop and child.
  *
  * If the leaf node has a child, then do not delete the node, 
  * only remove the nexthop info.
+ * The root node itself is never deleted.
  *
  * Input: prefix    (pointer to an array, that will be updated into the tree)
  * Input: size      (size of the prefix array)
- *                  if the size == 0, it signifies leaf node
  * Input: root      (Pointer to the root node)
  *
- * Output: Pointer to the current node or NULL
+ * Output: Pointer to the root node
  */
 extern lpm_node* 
 delete_prefix(lpm_node *root, int *prefix, int size);
@@ -97,6 +303,140 @@ delete_prefix(lpm_node *root, int *prefix, int size);
 extern int 
 find_route(int *prefix, lkp_result* result);
 
+/*
+ * This function inserts a prefix that points to a nexthop group.
+ * Same as insert_prefix(), the nexthop is picked per flow on lookup.
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+insert_prefix_nhg(int *prefix, int size, nh_group *group);
+
+/*
+ * This function searches for a given prefix in LPM like find_route().
+ * If the longest matched prefix uses a nexthop group, the member is
+ * selected by the flow hash through the group buckets, in O(1).
+ * Routes whose group has no member are skipped.
+ *
+ * Input: prefix    (pointer to an array, that will be searched in the tree)
+ * Input: flow_hash (hash of the flow the packet belongs to)
+ * Input: result    (pointer to the buffer that holds the nexthop info)
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+find_route_ecmp(int *prefix, unsigned int flow_hash, lkp_result *result);
+
+
+/*
+ * This function creates an empty nexthop group.
+ *
+ * Output: Pointer to the group or NULL (id in use or invalid)
+ */
+extern nh_group*
+nhg_create(int id);
+
+/*
+ * This function returns the nexthop group with the given id or NULL.
+ */
+extern nh_group*
+nhg_find(int id);
+
+/*
+ * This function frees a nexthop group that no route uses.
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+nhg_destroy(int id);
+
+/*
+ * This function adds a member to a nexthop group.
+ * The new member takes an equal share of the buckets from the members
+ * holding the most, no other bucket changes owner.
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+nhg_add_member(nh_group *group, int nexthop, int port);
+
+/*
+ * This function removes a member from a nexthop group.
+ * Only the buckets of the removed member are handed over, each to the
+ * member holding the fewest.
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+nhg_del_member(nh_group *group, int nexthop, int port);
+
+/*
+ * This function returns the member selected by the flow hash,
+ * NULL if the group is empty.
+ */
+extern const nh_member*
+nhg_select(const nh_group *group, unsigned int flow_hash);
+
+/*
+ * This function takes the nexthop group action from the user.
+ * It updates the cache (result) when group members change.
+ */
+extern void
+nhg_menu(lkp_result *result);
+
+
+/*
+ * This function starts an iteration over the routes of a LPM tree.
+ * Routes are returned in order: by prefix bits, shorter prefix first.
+ *
+ * Input: iter      (pointer to the iterator)
+ * Input: root      (pointer to the root node)
+ * Input: mode      LPM_ITER_ALL      - every route, prefix/len are ignored
+ *                  LPM_ITER_SUBTREE  - prefix/len and its more specifics
+ *                  LPM_ITER_COVERING - the routes covering the address
+ *                                      'prefix' that are at most len long
+ * Input: prefix    (prefix or address, host byte order)
+ * Input: len       (prefix length, 0 to 32)
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+lpm_iter_init(lpm_iter *iter, lpm_node *root, int mode,
+              unsigned int prefix, int len);
+
+/*
+ * This function moves the iterator just past prefix/len, so the next
+ * route returned is the first one after it, whether prefix/len is in the
+ * tree or not. Used to resume an iteration.
+ *
+ * Output: 0 - Success
+ *        -1 - Error (prefix outside of the iterated routes)
+ */
+extern int
+lpm_iter_seek(lpm_iter *iter, unsigned int prefix, int len);
+
+/*
+ * This function returns the next route of the iteration.
+ * The tree must not be modified during the iteration.
+ *
+ * Output: TRUE  - route filled
+ *         FALSE - no more routes
+ */
+extern int
+lpm_iter_next(lpm_iter *iter, lpm_route *route);
+
+/*
+ * This function prints every route of the LPM tree.
+ */
+extern void
+dump_routes(lpm_node *root);
+
 
 /*
  * This function is called whenever add/delete operation is performed in the LPM tree.
@@ -132,8 +472,253 @@ register_ip(lkp_result *result);
 extern void
 init_globals(void);
 
+/*
+ * These functions allocate/free a LPM tree node and keep the arena
+ * counters up to date. Slab nodes are not freed, only counted as holes.
+ */
+extern lpm_node*
+lpm_node_alloc(void);
+
+extern void
+lpm_node_free(lpm_node *node);
+
+/*
+ * This function records a prefix added or deleted while a compaction
+ * runs, it is called with the update lock held.
+ */
+extern void
+lpm_compact_note(const int *prefix, int size);
+
+/*
+ * This function starts a compaction of the LPM tree in the background.
+ * The live nodes are copied depth first into a new slab. The copy holds
+ * the update lock for COMPACT_SLICE nodes at a time, so updates go on
+ * and are recorded with lpm_compact_note(); lookups are not blocked.
+ *
+ * A finished copy that was not swapped in yet is handled first.
+ *
+ * Output: 0 - Success
+ *        -1 - Error (compaction already running)
+ */
+extern int
+lpm_compact_start(void);
+
+/*
+ * This function swaps in the compacted tree once the copy is done.
+ * The prefixes updated since the copy started are copied again from the
+ * live tree, then the old nodes are freed.
+ * It must be called when no lookup is in progress.
+ */
+extern void
+lpm_compact_poll(void);
+
+/*
+ * This function waits for a running compaction and swaps it in.
+ */
+extern void
+lpm_compact_wait(void);
+
+/*
+ * This function is called after updates. It swaps in a finished copy,
+ * and starts a compaction when none is running and the share of nodes
+ * scattered on the heap or left as holes in the slab reaches COMPACT_FRAG.
+ */
+extern void
+lpm_compact_check(void);
+
+/*
+ * This function prints the node counters and the fragmentation.
+ */
+extern void
+lpm_compact_report(void);
+
 extern void 
 fill_data(lpm_node **node, int data, int nh, int port);
 
 extern void
 dec2bin(unsigned int nw_ip, int *prefix, int size);
+
+
+/*
+ * This function creates an empty multibit trie.
+ * The strides must add up to the address width.
+ *
+ * Input: width     (address width in bits, 32 or 128)
+ * Input: stride    (pointer to an array of strides, one per level)
+ * Input: nlevels   (number of strides)
+ *
+ * Output: Pointer to the new table or NULL
+ */
+extern mbt_table*
+mbt_create(int width, const int *stride, int nlevels);
+
+/*
+ * This function frees a multibit trie and all of its routes.
+ */
+extern void
+mbt_destroy(mbt_table *table);
+
+/*
+ * This function inserts (or updates) a route in the multibit trie.
+ *
+ * Walk (or create) one node per stride until the node the prefix ends in,
+ * then expand the prefix into every slot it covers, unless the slot
+ * already holds a longer prefix.
+ *
+ * Input: table     (pointer to the multibit trie)
+ * Input: prefix    (route prefix, network byte order)
+ * Input: len       (prefix length, 1 to table width)
+ * Input: nexthop   (nexthop address, network byte order)
+ * Input: port      (source port)
+ *
+ * Output: 0 - Success
+ *        -1 - Error
+ */
+extern int
+mbt_insert(mbt_table *table, const unsigned char *prefix, int len,
+           const unsigned char *nexthop, int port);
+
+/*
+ * This function deletes a route from the multibit trie.
+ *
+ * The slots the route was expanded into fall back to the next longest
+ * prefix of the same node that covers them. Nodes left without routes
+ * and children are freed.
+ *
+ * Output: 0 - Success
+ *        -1 - Error (route not found)
+ */
+extern int
+mbt_delete(mbt_table *table, const unsigned char *prefix, int len);
+
+/*
+ * This function returns the longest prefix matching the address,
+ * or NULL if no route matches.
+ * It costs at most one memory access per level.
+ */
+extern const mbt_route*
+mbt_lookup(const mbt_table *table, const unsigned char *addr);
+
+/*
+ * This function copies every route of the multibit trie into 'out',
+ * which must hold table->nroutes entries.
+ *
+ * Output: number of routes copied
+ */
+extern int
+mbt_collect(const mbt_table *table, mbt_route *out);
+
+
+/*
+ * This function computes the stride layout for a set of routes
+ * using controlled prefix expansion.
+ *
+ * For every number of levels the layout with the least memory is found
+ * by dynamic programming over the number of one bit trie nodes at each
+ * depth. The layout with the fewest levels that fits in the budget wins.
+ * Levels past the longest prefix use 8 bit strides.
+ *
+ * Input: routes    (pointer to an array of routes)
+ * Input: nroutes   (number of routes)
+ * Input: width     (address width in bits)
+ * Input: budget    (memory budget in bytes)
+ * Input: plan      (pointer to the buffer that holds the chosen layout)
+ *
+ * Output: 0 - Success
+ *        -1 - Error (no layout fits, plan holds the smallest one)
+ */
+extern int
+stride_plan_compute(const mbt_route *routes, int nroutes, int width,
+                    size_t budget, stride_plan *plan);
+
+/*
+ * This function builds a multibit trie with the planned layout.
+ *
+ * Output: Pointer to the new table or NULL
+ */
+extern mbt_table*
+stride_build(const mbt_route *routes, int nroutes, int width,
+             const stride_plan *plan);
+
+/*
+ * This function attaches a tuner to a table.
+ */
+extern void
+stride_tuner_init(stride_tuner *tuner, mbt_table **table, size_t budget);
+
+/*
+ * This function is called after every successful add/delete on the table.
+ * It journals the update if a rebuild is running, else it starts one
+ * in the background when the table drifted from its plan.
+ */
+extern void
+stride_tuner_update(stride_tuner *tuner, int add, const unsigned char *prefix,
+                    int len, const unsigned char *nexthop, int port);
+
+/*
+ * This function swaps in a table rebuilt in the background.
+ * It must be called when no lookup is in progress on the table.
+ */
+extern void
+stride_tuner_poll(stride_tuner *tuner);
+
+/*
+ * This function prints the layout of the table and the expected
+ * memory accesses per lookup.
+ */
+extern void
+stride_report(stride_tuner *tuner);
+
+
+/*
+ * IPv6 counterparts of the IPv4 APIs above.
+ * IPv6 routes live in a multibit trie with a 16 bit first stride
+ * followed by 8 bit strides, i.e. 7 memory accesses for a /64.
+ * If there is no match the default nexthop is ::1 on port 999.
+ */
+extern int
+find_route6(const unsigned char *addr, lkp6_result *result);
+
+extern void
+update_reg_ip6(lkp6_result *result);
+
+extern void
+add_delete_route6(int add, lkp6_result *result);
+
+extern lkp6_result*
+register_ip6(lkp6_result *result);
+
+/*
+ * This function takes the IPv6 action ([a]dd, [d]elete, [r]egister or
+ * [s]tride report) from the user and calls the respective API.
+ */
+extern void
+ipv6_menu(lkp6_result *result);
+
+
+/*
+ * This function runs a differential stress test of the IPv4 lookup
+ * engines (binary trie, multibit trie with a fixed and a tuned layout).
+ * Random adds, deletes, lookups and table walks are applied to every
+ * engine and to an oracle that scans all the routes; every answer,
+ * including the 127.0.0.1/999 default, must match the oracle.
+ * The first mismatch of an engine is shrunk to a short list of
+ * operations and printed. The throughput of the engines on the same
+ * operations is reported. The user's routing table is left as is.
+ *
+ * Input: ops      (number of operations)
+ * Input: routes   (number of prefixes the operations pick from)
+ * Input: seed     (random seed, the same seed gives the same operations)
+ *
+ * Output: number of mismatches, 0 if every engine matches the oracle
+ *        -1 - Error (invalid parameters)
+ */
+extern int
+lpm_stress(int ops, int routes, unsigned int seed);
+
+/*
+ * This function takes the stress test parameters from the user and
+ * runs lpm_stress().
+ */
+extern void
+stress_menu(void);
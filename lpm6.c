@@ -0,0 +1,291 @@
+/******************************************************************************
+IPv6 Longest Prefix Match
+
+Functions to :
+add/delete IPv6 route entry into a routing table that uses a multibit trie
+search for a given IPv6 address
+
+*******************************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+/* IPv6 routing table */
+mbt_table *fib6;
+
+/* keeps the stride layout of fib6 tuned to its routes */
+stride_tuner tuner6;
+
+/* flag to signify that
+ * the Registered IPv6 address is valid.
+ */
+int cache6;
+
+
+/*
+ * API to search a IPv6 address
+ * refer lpm.h for details.
+ */
+int
+find_route6(const unsigned char *addr, lkp6_result *result)
+{
+    const mbt_route *rt = NULL;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (fib6 == NULL || addr == NULL || result == NULL) {
+    /* invalid input parameters */
+        printf("Invalid parameter fib6 %p addr %p, result %p.\n",
+                                            fib6, addr, result);
+        return EINVAL;
+    }
+
+    rt = mbt_lookup(fib6, addr);
+    if (rt != NULL) {
+        (void)memcpy(result->nh, rt->nexthop, IPv6_BYTES);
+        result->sp = rt->src_port;
+    } else {
+        /* local host ::1, CPU port */
+        (void)memset(result->nh, 0, IPv6_BYTES);
+        result->nh[IPv6_BYTES-1] = 1;
+        result->sp = 999;
+    }
+    cache6 = TRUE;
+
+    return EOK;
+}
+
+/*
+ * Callback API to update the Registered IPv6 address in the cache.
+ * refer lpm.h for details.
+ */
+void
+update_reg_ip6(lkp6_result *result) {
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if(result == NULL) {
+        printf("%s:%d Invalid Input Parameters\n", __FUNCTION__, __LINE__);
+        return;
+    }
+
+    if (result->registered) {
+        int rc = find_route6(result->last_ip, result);
+        if (rc != EOK) {
+            printf("Route lookup failed rc %d.Registered ip cache not updated\n",rc);
+        }
+    }
+}
+
+/*
+ * API to add/delete user input into the IPv6 routing table.
+ * refer lpm.h for details.
+ */
+void
+add_delete_route6(int add, lkp6_result *result) {
+
+    char ip[IPv6_SIZE];                 //IPv6 route
+    struct in6_addr nw_ip;              //binary IPv6 route
+    int mask = 0;                       //network mask
+    char nh[IPv6_SIZE];                 //nexthop IPv6 address
+    struct in6_addr nw_nh;              //binary nexthop address
+    int port = 0;                       //egress source port
+    int rc = 0;
+
+    /*
+     * Change in Routing Table.
+     * Invalidate the register ip cache.
+     */
+    cache6 = FALSE;
+
+    /*
+     * initialise
+     */
+    (void)memset(&nw_ip, 0, sizeof(nw_ip));
+    (void)memset(&nw_nh, 0, sizeof(nw_nh));
+    (void)memset(ip, '\0',  IPv6_SIZE*sizeof(char));
+    (void)memset(nh, '\0',  IPv6_SIZE*sizeof(char));
+
+    /*
+     * Get the static routing entry from the user.
+     */
+    printf("Enter the IPv6 route ip: ");
+    scanf("%45s",ip);
+    printf("Enter the network mask (1 to 128): ");
+    scanf("%d",&mask);
+    if (add) {
+        printf("Enter the IPv6 nextop ip: ");
+        scanf("%45s",nh);
+        printf("Enter the o/p port: ");
+        scanf("%d",&port);
+    }
+
+    /*
+     * Validate the user Input
+     */
+    if ( (rc = inet_pton(AF_INET6, ip, &nw_ip)) == 0) {
+      printf("Invalid IPv6 address: %s\n", ip);
+      return;
+    } else if (rc == -1) {
+      perror("inet_pton");
+      return;
+    }
+    if(mask < 1 || mask > MAX_DEPTH6) {
+        printf("Invalid mask: %d\n",mask);
+        return;
+    }
+    if (add) {
+        if ( (rc = inet_pton(AF_INET6, nh, &nw_nh)) == 0) {
+            printf("Invalid IPv6 nexthop address: %s\n", nh);
+            return;
+        } else if (rc == -1) {
+            printf("inet_pton internal error");
+            return;
+        }
+        if (port < 0) {
+            printf("Invalid port: %d (negative value)\n",port);
+            return;
+        }
+    }
+
+    if (add) {
+    /*
+     * Insert the prefix into the multibit trie
+     */
+        rc = mbt_insert(fib6, nw_ip.s6_addr, mask, nw_nh.s6_addr, port);
+        if(rc == EOK) {
+            stride_tuner_update(&tuner6, TRUE, nw_ip.s6_addr, mask,
+                                nw_nh.s6_addr, port);
+            printf("IPv6 Route %s/%d added successfully.\n", ip, mask);
+        } else {
+            printf("IPv6 Route add failed. rc = %d\n",rc);
+        }
+    } else {
+    /*
+     * DELETE PREFIX
+     */
+        rc = mbt_delete(fib6, nw_ip.s6_addr, mask);
+        if(rc == EOK) {
+            stride_tuner_update(&tuner6, FALSE, nw_ip.s6_addr, mask,
+                                NULL, 0);
+            printf("IPv6 Route %s/%d deleted.\n", ip, mask);
+        } else {
+            printf("IPv6 Route %s/%d not found.\n", ip, mask);
+        }
+    }
+
+    (void)update_reg_ip6(result);
+}
+
+/*
+ * API to get user input and update the register ip cache with the latest lookup request
+ * refer lpm.h for details.
+ */
+lkp6_result*
+register_ip6(lkp6_result *result) {
+
+    char ip[IPv6_SIZE];
+    struct in6_addr nw_ip;
+    int rc = 0;
+
+    /*
+     * initialise
+     */
+    (void)memset(&nw_ip, 0, sizeof(nw_ip));
+    (void)memset(ip, '\0',  IPv6_SIZE*sizeof(char));
+
+    /*
+     * get user Input
+     */
+    printf("IPv6 address to search: ");
+    scanf("%45s",ip);
+
+    /*
+     * Validate the user Input
+     */
+    if ( (rc = inet_pton(AF_INET6, ip, &nw_ip)) == 0) {
+      printf("Invalid IPv6 address: %s\n", ip);
+      return NULL;
+    } else if (rc == -1) {
+      perror("inet_pton");
+      return NULL;
+    }
+
+    /*
+     * if there is no change in the registered ip,
+     * return previous cached result.
+     */
+    if (cache6 && result->registered &&
+        memcmp(result->last_ip, nw_ip.s6_addr, IPv6_BYTES) == 0) {
+        return result;
+    }
+
+    /*
+     * user wants to register new IP
+     */
+    rc = find_route6(nw_ip.s6_addr, result);
+    if (rc == EOK) {
+        /*
+         * update last registed ip
+         */
+        (void)memcpy(result->last_ip, nw_ip.s6_addr, IPv6_BYTES);
+        result->registered = TRUE;
+    } else {
+        printf("Route lookup failed rc %d.Registered ip not updated\n",rc);
+    }
+
+    return result;
+}
+
+/*
+ * API to perform the IPv6 operations requested by the user.
+ * refer lpm.h for details.
+ */
+void
+ipv6_menu(lkp6_result *result)
+{
+    char user_data;
+    char nh[IPv6_SIZE];
+
+    /* swap in the table rebuilt in the background, if any */
+    stride_tuner_poll(&tuner6);
+
+    printf("IPv6: [a]dd route, [d]elete route, [r]egister or [s]trides: ");
+    scanf(" %c",&user_data);
+
+    switch (user_data) {
+        case 'a':
+        case 'A':
+            add_delete_route6(TRUE, result);
+            break;
+
+        case 'd':
+        case 'D':
+            add_delete_route6(FALSE, result);
+            break;
+
+        case 'r':
+        case 'R':
+            if (register_ip6(result) != NULL) {
+                inet_ntop(AF_INET6, result->nh, nh, IPv6_SIZE);
+                printf("Registered Nexthop %s\n",nh);
+                printf("Source Port %d\n",result->sp);
+            }
+            break;
+
+        case 's':
+        case 'S':
+            stride_report(&tuner6);
+            break;
+
+        default:
+            printf("Invalid Input.\n");
+            break;
+    }
+}
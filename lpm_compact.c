@@ -0,0 +1,436 @@
+/******************************************************************************
+LPM tree compaction
+
+Functions to :
+allocate/free the LPM tree nodes
+copy the live nodes into a contiguous slab in depth first order
+swap the compacted tree in without stopping lookups
+
+After route churn the nodes are scattered over the heap in insertion
+order. The compaction puts the nodes of a lookup path next to each other,
+so a lookup walks through a few cache lines instead of one per level.
+
+The copy takes the update lock for COMPACT_SLICE nodes at a time, so
+updates go on during the copy. The prefixes they touch are journaled,
+and their paths are copied again from the live tree before the swap.
+
+*******************************************************************************/
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+ #define COMPACT_IDLE     0
+ #define COMPACT_RUNNING  1
+ #define COMPACT_DONE     2
+
+
+extern lpm_node *root;
+
+/* where the tree nodes live */
+lpm_arena arena;
+
+/* serializes tree updates and the compaction copy */
+pthread_mutex_t lpm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Prefix updated while a compaction runs
+ */
+typedef struct compact_update {
+    unsigned int prefix;        //prefix bits, most significant first
+    int len;
+} compact_update;
+
+/* background compaction */
+static atomic_int compact_state;
+static pthread_t compact_thread;
+static lpm_node *compact_root;      //copy of the tree
+static lpm_node *compact_slab;
+static int compact_size;            //nodes in the slab
+static int compact_heap;            //copied nodes that did not fit the slab
+
+/* prefixes updated since the copy started */
+static compact_update *journal;
+static int njournal;
+static int max_journal;
+
+/* nodes deleted while the copy may still read them */
+static lpm_node **dead;
+static int ndead;
+static int max_dead;
+
+
+/*
+ * TRUE if the node lives in the slab
+ */
+static inline int
+in_slab(const lpm_node *node, const lpm_node *slab, int size)
+{
+    return slab != NULL && (uintptr_t)node >= (uintptr_t)slab &&
+                           (uintptr_t)node < (uintptr_t)(slab + size);
+}
+
+/*
+ * Grow an array of 'size' byte elements to hold one more.
+ */
+static void*
+compact_grow(void *array, int count, int *max, size_t size)
+{
+    if (count < *max) {
+        return array;
+    }
+    *max = *max ? *max * 2 : 256;
+    array = realloc(array, *max * size);
+    if (array == NULL) {
+        printf("realloc failed.\n");
+        exit(0);
+    }
+    return array;
+}
+
+/*
+ * API to allocate a tree node.
+ * refer lpm.h for details.
+ */
+lpm_node*
+lpm_node_alloc(void)
+{
+    lpm_node *node = calloc(1,sizeof(lpm_node));
+    if (node == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    arena.heap_nodes++;
+
+    return node;
+}
+
+/*
+ * API to free a tree node.
+ * refer lpm.h for details.
+ */
+void
+lpm_node_free(lpm_node *node)
+{
+    if (in_slab(node, arena.slab, arena.slab_size)) {
+        /* hole in the slab, reclaimed by the next compaction */
+        arena.slab_dead++;
+        return;
+    }
+    arena.heap_nodes--;
+
+    if (atomic_load(&compact_state) == COMPACT_RUNNING) {
+        /* the copy may still read it, freed on the swap */
+        dead = compact_grow(dead, ndead, &max_dead, sizeof(lpm_node *));
+        dead[ndead++] = node;
+        return;
+    }
+    free(node);
+}
+
+/*
+ * API to record an updated prefix.
+ * refer lpm.h for details.
+ */
+void
+lpm_compact_note(const int *prefix, int size)
+{
+    unsigned int bits = 0;
+
+    if (atomic_load(&compact_state) == COMPACT_IDLE) {
+        return;
+    }
+
+    for (int i=0; i<size; i++) {
+        bits |= (unsigned int)prefix[i] << (MAX_DEPTH - 1 - i);
+    }
+    journal = compact_grow(journal, njournal, &max_journal,
+                           sizeof(compact_update));
+    journal[njournal].prefix = bits;
+    journal[njournal].len = size;
+    njournal++;
+}
+
+/*
+ * Background thread: copy the tree depth first into a new slab.
+ * A node is followed by its left subtree, then its right subtree, so the
+ * nodes of a lookup path sit next to each other down to the leaf.
+ * The stack holds the child pointers of the copies still to be redirected.
+ */
+static void*
+compact_main(void *arg)
+{
+    lpm_node **stack[2*MAX_DEPTH+2];    //child pointers left to copy
+    int top = 0;
+    int live = 0;
+    int tail = 0;
+    int copied = 0;
+
+    (void)arg;
+
+    pthread_mutex_lock(&lpm_lock);
+
+    live = arena.heap_nodes + arena.slab_size - arena.slab_dead;
+    compact_slab = calloc(live, sizeof(lpm_node));
+    if (compact_slab == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    compact_heap = 0;
+
+    compact_root = &compact_slab[tail++];
+    *compact_root = *root;
+    stack[top++] = &compact_root->right;
+    stack[top++] = &compact_root->left;
+
+    while (top > 0) {
+        lpm_node **child = stack[--top];
+        lpm_node *node = NULL;
+
+        if (*child == NULL) {
+            continue;
+        }
+        if (++copied % COMPACT_SLICE == 0) {
+            /* let the updates waiting on the lock in */
+            pthread_mutex_unlock(&lpm_lock);
+            sched_yield();
+            pthread_mutex_lock(&lpm_lock);
+        }
+
+        if (tail < live) {
+            node = &compact_slab[tail++];
+        } else {
+            /* tree grew during the copy */
+            node = calloc(1, sizeof(lpm_node));
+            if (node == NULL) {
+                printf("calloc failed.\n");
+                exit(0);
+            }
+            compact_heap++;
+        }
+        *node = **child;
+        *child = node;
+        stack[top++] = &node->right;
+        stack[top++] = &node->left;
+    }
+    compact_size = tail;
+
+    pthread_mutex_unlock(&lpm_lock);
+
+    atomic_store(&compact_state, COMPACT_DONE);
+
+    return NULL;
+}
+
+/*
+ * Copy the route of a journaled prefix from the old tree to the new one.
+ * Nodes are allocated/freed against the arena of the new tree.
+ */
+static void
+compact_fix(lpm_node *old_root, const compact_update *u)
+{
+    lpm_node *path[MAX_DEPTH+1];
+    const lpm_node *old = old_root;
+    lpm_node *node = root;
+    int depth = 0;
+
+    for (depth=0; depth<u->len && old != NULL; depth++) {
+        int bit = (u->prefix >> (MAX_DEPTH - 1 - depth)) & 1;
+        old = bit ? old->right : old->left;
+    }
+
+    path[0] = root;
+    for (depth=0; depth<u->len; depth++) {
+        int bit = (u->prefix >> (MAX_DEPTH - 1 - depth)) & 1;
+        lpm_node **child = bit ? &node->right : &node->left;
+
+        if (*child == NULL) {
+            if (old == NULL || old->nexthop == -1) {
+                /*
+                 * route gone in both trees. The copy may still end in
+                 * nodes deleted during the copy, left without children.
+                 */
+                break;
+            }
+            *child = lpm_node_alloc();
+            fill_data(child, bit, -1, -1);
+        }
+        node = *child;
+        path[depth+1] = node;
+    }
+
+    if (depth == u->len) {
+        if (old != NULL && old->nexthop != -1) {
+            /* refcounts were taken by the update on the old tree */
+            node->nexthop = old->nexthop;
+            node->src_port = old->src_port;
+            node->group = old->group;
+            return;
+        }
+        node->nexthop = -1;
+        node->src_port = -1;
+        node->group = NULL;
+    }
+
+    for (; depth>0; depth--) {
+        node = path[depth];
+        if (node->left != NULL || node->right != NULL || node->nexthop != -1) {
+            break;
+        }
+        if (path[depth-1]->left == node) {
+            path[depth-1]->left = NULL;
+        } else {
+            path[depth-1]->right = NULL;
+        }
+        lpm_node_free(node);
+    }
+}
+
+/*
+ * API to start a background compaction.
+ * refer lpm.h for details.
+ */
+int
+lpm_compact_start(void)
+{
+    /* a finished copy is swapped in first */
+    lpm_compact_poll();
+
+    if (root == NULL || atomic_load(&compact_state) != COMPACT_IDLE) {
+        return EINVAL;
+    }
+
+    njournal = 0;
+    ndead = 0;
+    atomic_store(&compact_state, COMPACT_RUNNING);
+    if (pthread_create(&compact_thread, NULL, compact_main, NULL) != 0) {
+        printf("Compaction thread create failed.\n");
+        atomic_store(&compact_state, COMPACT_IDLE);
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+/*
+ * API to swap in the compacted tree.
+ * refer lpm.h for details.
+ */
+void
+lpm_compact_poll(void)
+{
+    lpm_node *stack[2*MAX_DEPTH+2];     //old nodes left to free
+    int top = 0;
+    lpm_node *old_root = root;
+    lpm_arena old_arena = arena;
+
+    if (atomic_load(&compact_state) != COMPACT_DONE) {
+        return;
+    }
+    (void)pthread_join(compact_thread, NULL);
+
+    /*
+     * swap the root, then bring the paths updated during the copy
+     * up to date from the old tree
+     */
+    root = compact_root;
+    arena.slab = compact_slab;
+    arena.slab_size = compact_size;
+    arena.slab_dead = 0;
+    arena.heap_nodes = compact_heap;
+
+    for (int i=0; i<njournal; i++) {
+        compact_fix(old_root, &journal[i]);
+    }
+
+    /*
+     * free the old heap nodes and the old slab
+     */
+    stack[top++] = old_root;
+    while (top > 0) {
+        lpm_node *node = stack[--top];
+        if (node->left != NULL) {
+            stack[top++] = node->left;
+        }
+        if (node->right != NULL) {
+            stack[top++] = node->right;
+        }
+        if (!in_slab(node, old_arena.slab, old_arena.slab_size)) {
+            free(node);
+        }
+    }
+    for (int i=0; i<ndead; i++) {
+        free(dead[i]);
+    }
+    free(old_arena.slab);
+
+    njournal = 0;
+    ndead = 0;
+    compact_root = NULL;
+    compact_slab = NULL;
+    atomic_store(&compact_state, COMPACT_IDLE);
+}
+
+/*
+ * API to wait for a running compaction.
+ * refer lpm.h for details.
+ */
+void
+lpm_compact_wait(void)
+{
+    if (atomic_load(&compact_state) == COMPACT_IDLE) {
+        return;
+    }
+    while (atomic_load(&compact_state) != COMPACT_DONE) {
+        sched_yield();
+    }
+    lpm_compact_poll();
+}
+
+/*
+ * API to start a compaction when the tree is fragmented.
+ * refer lpm.h for details.
+ */
+void
+lpm_compact_check(void)
+{
+    int live = 0;
+    int scattered = 0;
+
+    /* a running copy stays useful, the updates are journaled */
+    lpm_compact_poll();
+    if (atomic_load(&compact_state) != COMPACT_IDLE) {
+        return;
+    }
+
+    live = arena.heap_nodes + arena.slab_size - arena.slab_dead;
+    scattered = arena.heap_nodes + arena.slab_dead;
+    if (live < COMPACT_MIN_NODES ||
+        scattered < COMPACT_FRAG * (live + arena.slab_dead)) {
+        return;
+    }
+
+    (void)lpm_compact_start();
+}
+
+/*
+ * API to print the node counters.
+ * refer lpm.h for details.
+ */
+void
+lpm_compact_report(void)
+{
+    int live = arena.heap_nodes + arena.slab_size - arena.slab_dead;
+    int scattered = arena.heap_nodes + arena.slab_dead;
+
+    printf("Nodes %d: slab %d, heap %d, holes %d\n", live,
+            arena.slab_size - arena.slab_dead, arena.heap_nodes,
+            arena.slab_dead);
+    printf("Fragmentation %.0f%%%s\n",
+            live ? 100.0 * scattered / (live + arena.slab_dead) : 0.0,
+            atomic_load(&compact_state) != COMPACT_IDLE ?
+                                    ", compaction in progress" : "");
+}
@@ -0,0 +1,300 @@
+/******************************************************************************
+LPM tree iterator
+
+Functions to :
+walk the routes of the LPM tree in order, without recursion or allocation
+resume the walk after a given prefix
+dump the routing table
+
+*******************************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+/*
+ * steps of a node on the iterator stack
+ */
+ #define ITER_SELF   0      //return the node route
+ #define ITER_LEFT   1      //go to the left child
+ #define ITER_RIGHT  2      //go to the right child
+ #define ITER_UP     3      //node done, go back to the parent
+
+
+/*
+ * Mask of the first 'len' bits of an address
+ */
+static inline unsigned int
+iter_mask(int len)
+{
+    return len ? ~0u << (MAX_DEPTH - len) : 0;
+}
+
+/*
+ * Bit 'depth' (0 is the most significant) of an address
+ */
+static inline int
+iter_bit(unsigned int addr, int depth)
+{
+    return (addr >> (MAX_DEPTH - 1 - depth)) & 1;
+}
+
+/*
+ * Push the child taken with 'bit' on the iterator stack.
+ */
+static inline void
+iter_push(lpm_iter *iter, lpm_node *child, int bit)
+{
+    int depth = iter->depth;
+
+    iter->path = (iter->path & iter_mask(depth)) |
+                 ((unsigned int)bit << (MAX_DEPTH - 1 - depth));
+    iter->depth = depth + 1;
+    iter->stack[depth+1] = child;
+    iter->state[depth+1] = ITER_SELF;
+}
+
+/*
+ * Fill the route of the node at 'depth' on the current path.
+ */
+static inline void
+iter_fill(const lpm_iter *iter, const lpm_node *node, int depth,
+          lpm_route *route)
+{
+    route->prefix = iter->path & iter_mask(depth);
+    route->len = depth;
+    route->nexthop = node->nexthop;
+    route->src_port = node->src_port;
+    route->group = node->group != NULL ? node->group->id : 0;
+}
+
+/*
+ * API to start an iteration.
+ * refer lpm.h for details.
+ */
+int
+lpm_iter_init(lpm_iter *iter, lpm_node *root, int mode,
+              unsigned int prefix, int len)
+{
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (iter == NULL || root == NULL || len < 0 || len > MAX_DEPTH ||
+        mode < LPM_ITER_ALL || mode > LPM_ITER_COVERING) {
+        printf("Invalid parameter iter %p root %p mode %d len %d\n",
+                                     iter, root, mode, len);
+        return EINVAL;
+    }
+
+    iter->mode = mode;
+    iter->depth = 0;
+    iter->base = 0;
+    iter->limit = MAX_DEPTH;
+    iter->path = 0;
+    iter->stack[0] = root;
+    iter->state[0] = ITER_SELF;
+
+    if (mode == LPM_ITER_COVERING) {
+        iter->path = prefix;
+        iter->limit = len;
+        return EOK;
+    }
+
+    if (mode == LPM_ITER_SUBTREE) {
+        /* walk down to the subtree, nothing to return if it is missing */
+        while (iter->depth < len) {
+            lpm_node *node = iter->stack[iter->depth];
+            int bit = iter_bit(prefix, iter->depth);
+            lpm_node *child = bit ? node->right : node->left;
+            if (child == NULL) {
+                /* empty iteration */
+                iter->depth = -1;
+                iter->limit = -1;
+                return EOK;
+            }
+            iter_push(iter, child, bit);
+        }
+        iter->base = len;
+    }
+
+    return EOK;
+}
+
+/*
+ * API to resume an iteration after a prefix.
+ * refer lpm.h for details.
+ */
+int
+lpm_iter_seek(lpm_iter *iter, unsigned int prefix, int len)
+{
+    if (iter == NULL || len < 0 || len > MAX_DEPTH) {
+        printf("Invalid parameter iter %p len %d\n", iter, len);
+        return EINVAL;
+    }
+
+    if (iter->mode == LPM_ITER_COVERING) {
+        /* covering prefixes are returned shortest first */
+        if (((prefix ^ iter->path) & iter_mask(len)) != 0) {
+            return EINVAL;
+        }
+        iter->depth = 0;
+        while (iter->depth < len) {
+            lpm_node *node = iter->stack[iter->depth];
+            int bit = iter_bit(iter->path, iter->depth);
+            lpm_node *child = bit ? node->right : node->left;
+            if (child == NULL) {
+                break;
+            }
+            iter->depth++;
+            iter->stack[iter->depth] = child;
+        }
+        iter->state[iter->depth] = ITER_LEFT;
+        return EOK;
+    }
+
+    if (len < iter->base ||
+        ((prefix ^ iter->path) & iter_mask(iter->base)) != 0) {
+        return EINVAL;
+    }
+    if (iter->limit < 0) {
+        /* subtree not in the tree, nothing to resume */
+        return EOK;
+    }
+
+    /*
+     * Rebuild the stack as if prefix/len was just returned: every node on
+     * its path has already visited the child the path goes through.
+     * If the path ends early, the missing subtree is skipped.
+     */
+    iter->depth = iter->base;
+    while (iter->depth < len) {
+        lpm_node *node = iter->stack[iter->depth];
+        int bit = iter_bit(prefix, iter->depth);
+        lpm_node *child = bit ? node->right : node->left;
+
+        iter->state[iter->depth] = bit ? ITER_UP : ITER_RIGHT;
+        if (child == NULL) {
+            return EOK;
+        }
+        iter_push(iter, child, bit);
+    }
+    iter->state[len] = ITER_LEFT;
+
+    return EOK;
+}
+
+/*
+ * API to get the next route of an iteration.
+ * refer lpm.h for details.
+ */
+int
+lpm_iter_next(lpm_iter *iter, lpm_route *route)
+{
+    if (iter == NULL || route == NULL) {
+        return FALSE;
+    }
+
+    if (iter->mode == LPM_ITER_COVERING) {
+        /* single path, walk it down following the address */
+        while (iter->depth >= 0) {
+            int depth = iter->depth;
+            lpm_node *node = iter->stack[depth];
+
+            if (iter->state[depth] == ITER_SELF) {
+                iter->state[depth] = ITER_LEFT;
+                if (depth > 0 && node->nexthop != -1) {
+                    iter_fill(iter, node, depth, route);
+                    return TRUE;
+                }
+            } else if (depth >= iter->limit) {
+                iter->depth = -1;
+            } else {
+                lpm_node *child = iter_bit(iter->path, depth) ?
+                                        node->right : node->left;
+                if (child == NULL) {
+                    iter->depth = -1;
+                } else {
+                    iter->depth++;
+                    iter->stack[depth+1] = child;
+                    iter->state[depth+1] = ITER_SELF;
+                }
+            }
+        }
+        return FALSE;
+    }
+
+    /*
+     * Depth first walk: node, then left, then right subtree
+     */
+    while (iter->depth >= iter->base) {
+        int depth = iter->depth;
+        lpm_node *node = iter->stack[depth];
+
+        switch (iter->state[depth]) {
+            case ITER_SELF:
+                iter->state[depth] = ITER_LEFT;
+                if (depth > 0 && node->nexthop != -1) {
+                    iter_fill(iter, node, depth, route);
+                    return TRUE;
+                }
+                break;
+
+            case ITER_LEFT:
+                iter->state[depth] = ITER_RIGHT;
+                if (node->left != NULL) {
+                    iter_push(iter, node->left, 0);
+                }
+                break;
+
+            case ITER_RIGHT:
+                iter->state[depth] = ITER_UP;
+                if (node->right != NULL) {
+                    iter_push(iter, node->right, 1);
+                }
+                break;
+
+            default:
+                iter->depth--;
+                break;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * API to print the routing table.
+ * refer lpm.h for details.
+ */
+void
+dump_routes(lpm_node *root)
+{
+    lpm_iter iter;
+    lpm_route route;
+    char ip[IPv4_SIZE];
+    char nh[IPv4_SIZE];
+    int count = 0;
+
+    if (lpm_iter_init(&iter, root, LPM_ITER_ALL, 0, 0) != EOK) {
+        return;
+    }
+
+    while (lpm_iter_next(&iter, &route)) {
+        unsigned int nw_ip = htonl(route.prefix);
+        unsigned int nw_nh = htonl(route.nexthop);
+
+        inet_ntop(AF_INET, &nw_ip, ip, IPv4_SIZE);
+        if (route.group) {
+            printf("%s/%d nexthop group %d\n", ip, route.len, route.group);
+        } else {
+            inet_ntop(AF_INET, &nw_nh, nh, IPv4_SIZE);
+            printf("%s/%d nexthop %s port %d\n", ip, route.len, nh,
+                                                  route.src_port);
+        }
+        count++;
+    }
+    printf("%d routes\n", count);
+}
@@ -0,0 +1,452 @@
+/******************************************************************************
+Multibit trie
+
+Functions to :
+add/delete route entry into a multibit trie (controlled prefix expansion)
+search for the longest prefix matching an address
+
+The trie is address family agnostic, it is used for IPv6 routes.
+
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+/*
+ * Extract 'n' bits (n <= MBT_MAX_STRIDE) starting at bit 'off' of a
+ * network byte order address.
+ */
+static inline unsigned int
+mbt_bits(const unsigned char *addr, int off, int n)
+{
+    unsigned int w = 0;
+    int byte = off >> 3;
+
+    for (int i=0; i<4; i++) {
+        w = (w << 8) | (byte+i < IPv6_BYTES ? addr[byte+i] : 0);
+    }
+    w <<= (off & 7);
+
+    return w >> (32 - n);
+}
+
+/*
+ * Copy the first 'len' bits of the address and clear the host bits.
+ */
+static void
+mbt_mask(unsigned char *dst, const unsigned char *src, int len)
+{
+    (void)memset(dst, 0, IPv6_BYTES);
+    (void)memcpy(dst, src, (len + 7) / 8);
+    if (len % 8) {
+        dst[len / 8] &= (unsigned char)(0xff << (8 - len % 8));
+    }
+}
+
+/*
+ * Alloc a node for the given level.
+ */
+static mbt_node*
+mbt_node_alloc(mbt_table *table, int level)
+{
+    size_t size = sizeof(mbt_node) +
+                  ((size_t)1 << table->stride[level]) * sizeof(mbt_entry);
+
+    mbt_node *node = calloc(1, size);
+    if (node == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    table->nnodes++;
+    table->mem += size;
+
+    return node;
+}
+
+static void
+mbt_node_free(mbt_table *table, mbt_node *node, int level)
+{
+    table->nnodes--;
+    table->mem -= sizeof(mbt_node) +
+                  ((size_t)1 << table->stride[level]) * sizeof(mbt_entry);
+    table->mem -= node->max_routes * sizeof(mbt_route *);
+    free(node->routes);
+    free(node);
+}
+
+/*
+ * Find the route of 'len' bits ending in the node, NULL if not present.
+ */
+static mbt_route*
+mbt_node_find(mbt_node *node, const unsigned char *prefix, int len)
+{
+    for (int i=0; i<node->nroutes; i++) {
+        mbt_route *rt = node->routes[i];
+        if (rt->len == len && memcmp(rt->prefix, prefix, IPv6_BYTES) == 0) {
+            return rt;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * API to create a multibit trie.
+ * refer lpm.h for details.
+ */
+mbt_table*
+mbt_create(int width, const int *stride, int nlevels)
+{
+    mbt_table *table = NULL;
+    int total = 0;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (width < 1 || width > MAX_DEPTH6 || stride == NULL ||
+        nlevels < 1 || nlevels > MBT_MAX_LEVELS) {
+        printf("Invalid parameter width %d stride %p nlevels %d\n",
+                                       width, stride, nlevels);
+        return NULL;
+    }
+
+    for (int i=0; i<nlevels; i++) {
+        if (stride[i] < 1 || stride[i] > MBT_MAX_STRIDE) {
+            printf("Invalid stride. stride[%d] = %d\n", i, stride[i]);
+            return NULL;
+        }
+        total += stride[i];
+    }
+
+    if (total != width) {
+        printf("Strides cover %d bits, expected %d\n", total, width);
+        return NULL;
+    }
+
+    table = calloc(1, sizeof(mbt_table));
+    if (table == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+
+    table->width = width;
+    table->nlevels = nlevels;
+    for (int i=0, off=0; i<nlevels; i++) {
+        table->stride[i] = stride[i];
+        table->offset[i] = off;
+        off += stride[i];
+    }
+    table->root = mbt_node_alloc(table, 0);
+
+    return table;
+}
+
+/*
+ * API to free a multibit trie.
+ * refer lpm.h for details.
+ */
+void
+mbt_destroy(mbt_table *table)
+{
+    mbt_node *stack[MBT_MAX_LEVELS];    //nodes on the current path
+    int next[MBT_MAX_LEVELS];           //next slot to visit at each level
+    int level = 0;
+
+    if (table == NULL) {
+        return;
+    }
+
+    /*
+     * Depth first walk, a node is freed once all its slots are visited
+     */
+    stack[0] = table->root;
+    next[0] = 0;
+    while (level >= 0) {
+        mbt_node *node = stack[level];
+
+        if (next[level] < (1 << table->stride[level])) {
+            mbt_node *child = node->entry[next[level]++].child;
+            if (child != NULL) {
+                level++;
+                stack[level] = child;
+                next[level] = 0;
+            }
+            continue;
+        }
+
+        for (int i=0; i<node->nroutes; i++) {
+            free(node->routes[i]);
+        }
+        mbt_node_free(table, node, level);
+        level--;
+    }
+
+    free(table);
+}
+
+/*
+ * API to insert a route into the multibit trie.
+ * refer lpm.h for details.
+ */
+int
+mbt_insert(mbt_table *table, const unsigned char *prefix, int len,
+           const unsigned char *nexthop, int port)
+{
+    unsigned char key[IPv6_BYTES];      //prefix with the host bits cleared
+    mbt_node *node = NULL;
+    mbt_route *rt = NULL;
+    int level = 0;
+    int rel = 0;                        //prefix bits inside the last node
+    unsigned int base = 0;              //first slot covered by the prefix
+    unsigned int count = 0;             //number of slots covered
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (table == NULL || prefix == NULL || nexthop == NULL ||
+        len < 1 || len > table->width || port < 0) {
+        printf("Invalid parameter table %p len %d port %d\n",
+                                      table, len, port);
+        return EINVAL;
+    }
+
+    mbt_mask(key, prefix, len);
+
+    /*
+     * WALK THE TRIE AND CREATE THE MISSING LEVELS
+     */
+    node = table->root;
+    while (len > table->offset[level] + table->stride[level]) {
+        mbt_entry *e = &node->entry[mbt_bits(key, table->offset[level],
+                                             table->stride[level])];
+        if (e->child == NULL) {
+            e->child = mbt_node_alloc(table, level+1);
+            node->nchild++;
+        }
+        node = e->child;
+        level++;
+    }
+
+    /*
+     * route exists, only update the nexthop info.
+     * expanded slots point to the route so they are updated as well.
+     */
+    rt = mbt_node_find(node, key, len);
+    if (rt != NULL) {
+        (void)memcpy(rt->nexthop, nexthop, IPv6_BYTES);
+        rt->src_port = port;
+        return EOK;
+    }
+
+    rt = calloc(1, sizeof(mbt_route));
+    if (rt == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    (void)memcpy(rt->prefix, key, IPv6_BYTES);
+    (void)memcpy(rt->nexthop, nexthop, IPv6_BYTES);
+    rt->len = len;
+    rt->src_port = port;
+
+    if (node->nroutes == node->max_routes) {
+        int max = node->max_routes ? node->max_routes * 2 : 4;
+        mbt_route **routes = realloc(node->routes, max * sizeof(mbt_route *));
+        if (routes == NULL) {
+            printf("realloc failed.\n");
+            exit(0);
+        }
+        table->mem += (max - node->max_routes) * sizeof(mbt_route *);
+        node->routes = routes;
+        node->max_routes = max;
+    }
+    node->routes[node->nroutes++] = rt;
+    table->nroutes++;
+    table->len_count[len]++;
+    table->mem += sizeof(mbt_route);
+
+    /*
+     * EXPAND THE PREFIX INTO THE SLOTS IT COVERS
+     */
+    rel = len - table->offset[level];
+    base = mbt_bits(key, table->offset[level], rel) <<
+                                    (table->stride[level] - rel);
+    count = 1u << (table->stride[level] - rel);
+
+    for (unsigned int i=base; i<base+count; i++) {
+        if (node->entry[i].route == NULL || node->entry[i].route->len < len) {
+            node->entry[i].route = rt;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * API to delete a route from the multibit trie.
+ * refer lpm.h for details.
+ */
+int
+mbt_delete(mbt_table *table, const unsigned char *prefix, int len)
+{
+    unsigned char key[IPv6_BYTES];
+    mbt_node *path[MBT_MAX_LEVELS];     //nodes walked from the root
+    unsigned int slot[MBT_MAX_LEVELS];  //slot taken at each level
+    mbt_node *node = NULL;
+    mbt_route *rt = NULL;
+    mbt_route *repl = NULL;             //route that takes over the slots
+    int level = 0;
+    int rel = 0;
+    unsigned int base = 0;
+    unsigned int count = 0;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (table == NULL || prefix == NULL || len < 1 || len > table->width) {
+        printf("Invalid parameter table %p len %d\n", table, len);
+        return EINVAL;
+    }
+
+    mbt_mask(key, prefix, len);
+
+    /*
+     * WALK TO THE NODE THE PREFIX ENDS IN
+     */
+    node = table->root;
+    while (len > table->offset[level] + table->stride[level]) {
+        path[level] = node;
+        slot[level] = mbt_bits(key, table->offset[level], table->stride[level]);
+        node = node->entry[slot[level]].child;
+        if (node == NULL) {
+            return EINVAL;
+        }
+        level++;
+    }
+
+    rt = mbt_node_find(node, key, len);
+    if (rt == NULL) {
+        return EINVAL;
+    }
+
+    /*
+     * the slots fall back to the longest shorter prefix of the same node
+     * that covers the deleted one.
+     */
+    for (int i=0; i<node->nroutes; i++) {
+        mbt_route *cand = node->routes[i];
+        if (cand->len < len && (repl == NULL || cand->len > repl->len)) {
+            unsigned char masked[IPv6_BYTES];
+            mbt_mask(masked, key, cand->len);
+            if (memcmp(masked, cand->prefix, IPv6_BYTES) == 0) {
+                repl = cand;
+            }
+        }
+    }
+
+    rel = len - table->offset[level];
+    base = mbt_bits(key, table->offset[level], rel) <<
+                                    (table->stride[level] - rel);
+    count = 1u << (table->stride[level] - rel);
+
+    for (unsigned int i=base; i<base+count; i++) {
+        if (node->entry[i].route == rt) {
+            node->entry[i].route = repl;
+        }
+    }
+
+    for (int i=0; i<node->nroutes; i++) {
+        if (node->routes[i] == rt) {
+            node->routes[i] = node->routes[--node->nroutes];
+            break;
+        }
+    }
+    free(rt);
+    table->nroutes--;
+    table->len_count[len]--;
+    table->mem -= sizeof(mbt_route);
+
+    /*
+     * FREE THE NODES LEFT WITHOUT ROUTES AND CHILDREN
+     */
+    while (level > 0 && node->nroutes == 0 && node->nchild == 0) {
+        mbt_node_free(table, node, level);
+        level--;
+        node = path[level];
+        node->entry[slot[level]].child = NULL;
+        node->nchild--;
+    }
+
+    return EOK;
+}
+
+/*
+ * API to search the longest prefix in the multibit trie.
+ * refer lpm.h for details.
+ */
+const mbt_route*
+mbt_lookup(const mbt_table *table, const unsigned char *addr)
+{
+    const mbt_route *best = NULL;
+    const mbt_node *node = NULL;
+
+    if (table == NULL || addr == NULL) {
+        return NULL;
+    }
+
+    node = table->root;
+    for (int level=0; node != NULL; level++) {
+        const mbt_entry *e = &node->entry[mbt_bits(addr, table->offset[level],
+                                                   table->stride[level])];
+        if (e->route != NULL) {
+            best = e->route;
+        }
+        node = e->child;
+    }
+
+    return best;
+}
+
+/*
+ * API to copy the routes of a multibit trie.
+ * refer lpm.h for details.
+ */
+int
+mbt_collect(const mbt_table *table, mbt_route *out)
+{
+    const mbt_node *stack[MBT_MAX_LEVELS];
+    int next[MBT_MAX_LEVELS];
+    int level = 0;
+    int n = 0;
+
+    if (table == NULL || out == NULL) {
+        return 0;
+    }
+
+    stack[0] = table->root;
+    next[0] = 0;
+    for (int i=0; i<table->root->nroutes; i++) {
+        out[n++] = *table->root->routes[i];
+    }
+
+    while (level >= 0) {
+        const mbt_node *node = stack[level];
+
+        if (next[level] == (1 << table->stride[level])) {
+            level--;
+            continue;
+        }
+
+        node = node->entry[next[level]++].child;
+        if (node != NULL) {
+            level++;
+            stack[level] = node;
+            next[level] = 0;
+            for (int i=0; i<node->nroutes; i++) {
+                out[n++] = *node->routes[i];
+            }
+        }
+    }
+
+    return n;
+}
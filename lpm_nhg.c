@@ -0,0 +1,364 @@
+/******************************************************************************
+Nexthop groups
+
+Functions to :
+create/delete equal cost nexthop groups and their members
+select the member of a flow with resilient hashing
+
+*******************************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+extern int cache;
+
+/* list of nexthop groups */
+static nh_group *groups;
+
+
+/*
+ * Number of buckets owned by each member
+ */
+static void
+nhg_count(const nh_group *group, int *count)
+{
+    (void)memset(count, 0, NHG_MAX_MEMBERS*sizeof(int));
+    for (int b=0; b<NHG_BUCKETS; b++) {
+        count[group->bucket[b]]++;
+    }
+}
+
+/*
+ * Index of a member, -1 if not in the group
+ */
+static int
+nhg_member_index(const nh_group *group, int nexthop, int port)
+{
+    for (int i=0; i<group->nmembers; i++) {
+        if (group->member[i].nexthop == nexthop &&
+            group->member[i].src_port == port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * API to create a nexthop group.
+ * refer lpm.h for details.
+ */
+nh_group*
+nhg_create(int id)
+{
+    nh_group *group = NULL;
+
+    if (id < 1 || nhg_find(id) != NULL) {
+        printf("Invalid nexthop group id %d\n", id);
+        return NULL;
+    }
+
+    group = calloc(1, sizeof(nh_group));
+    if (group == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    group->id = id;
+    group->next = groups;
+    groups = group;
+
+    return group;
+}
+
+/*
+ * API to find a nexthop group.
+ * refer lpm.h for details.
+ */
+nh_group*
+nhg_find(int id)
+{
+    for (nh_group *group = groups; group != NULL; group = group->next) {
+        if (group->id == id) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * API to delete a nexthop group.
+ * refer lpm.h for details.
+ */
+int
+nhg_destroy(int id)
+{
+    for (nh_group **prev = &groups; *prev != NULL; prev = &(*prev)->next) {
+        nh_group *group = *prev;
+        if (group->id != id) {
+            continue;
+        }
+        if (group->refcnt) {
+            printf("Nexthop group %d used by %d routes\n", id, group->refcnt);
+            return EINVAL;
+        }
+        *prev = group->next;
+        free(group);
+        return EOK;
+    }
+
+    return EINVAL;
+}
+
+/*
+ * API to add a member to a nexthop group.
+ * refer lpm.h for details.
+ */
+int
+nhg_add_member(nh_group *group, int nexthop, int port)
+{
+    int count[NHG_MAX_MEMBERS];         //buckets owned by each member
+    int give[NHG_MAX_MEMBERS];          //buckets each member hands over
+    int kept[NHG_MAX_MEMBERS];          //TRUE if the member keeps an extra bucket
+    int idx = 0;                        //index of the new member
+    int share = 0;                      //buckets the new member gets
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (group == NULL || nexthop == -1 || port < 0 ||
+        group->nmembers == NHG_MAX_MEMBERS ||
+        nhg_member_index(group, nexthop, port) != -1) {
+        printf("Invalid parameter group %p nexthop %d port %d\n",
+                                   group, nexthop, port);
+        return EINVAL;
+    }
+
+    idx = group->nmembers++;
+    group->member[idx].nexthop = nexthop;
+    group->member[idx].src_port = port;
+
+    if (idx == 0) {
+        /* first member owns every bucket */
+        (void)memset(group->bucket, 0, NHG_BUCKETS);
+        return EOK;
+    }
+
+    /*
+     * Every member keeps NHG_BUCKETS/n buckets, the ones with the most
+     * buckets keep one more until the remainder is used up.
+     * Whatever is left over moves to the new member.
+     */
+    nhg_count(group, count);
+    share = NHG_BUCKETS / group->nmembers;
+    for (int i=0; i<idx; i++) {
+        give[i] = count[i] - share;
+        kept[i] = FALSE;
+    }
+    for (int extra = NHG_BUCKETS % group->nmembers; extra > 0; extra--) {
+        int most = -1;
+        for (int i=0; i<idx; i++) {
+            if (!kept[i] && give[i] > 0 && (most == -1 || give[i] > give[most])) {
+                most = i;
+            }
+        }
+        if (most == -1) {
+            break;
+        }
+        give[most]--;
+        kept[most] = TRUE;
+    }
+
+    for (int b=0; b<NHG_BUCKETS; b++) {
+        int owner = group->bucket[b];
+        if (give[owner] > 0) {
+            give[owner]--;
+            group->bucket[b] = idx;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * API to remove a member from a nexthop group.
+ * refer lpm.h for details.
+ */
+int
+nhg_del_member(nh_group *group, int nexthop, int port)
+{
+    int count[NHG_MAX_MEMBERS];
+    int idx = 0;
+
+    if (group == NULL) {
+        printf("Invalid parameter group %p\n", group);
+        return EINVAL;
+    }
+
+    idx = nhg_member_index(group, nexthop, port);
+    if (idx == -1) {
+        return EINVAL;
+    }
+
+    /*
+     * hand the buckets of the member over, one by one,
+     * to the member that owns the fewest
+     */
+    nhg_count(group, count);
+    count[idx] = NHG_BUCKETS + 1;
+    for (int b=0; b<NHG_BUCKETS && group->nmembers > 1; b++) {
+        int fewest = 0;
+        if (group->bucket[b] != idx) {
+            continue;
+        }
+        for (int i=1; i<group->nmembers; i++) {
+            if (count[i] < count[fewest]) {
+                fewest = i;
+            }
+        }
+        group->bucket[b] = fewest;
+        count[fewest]++;
+    }
+
+    /* close the gap in the member array, bucket owners are renumbered */
+    for (int i=idx+1; i<group->nmembers; i++) {
+        group->member[i-1] = group->member[i];
+    }
+    for (int b=0; b<NHG_BUCKETS; b++) {
+        if (group->bucket[b] > idx) {
+            group->bucket[b]--;
+        }
+    }
+    group->nmembers--;
+
+    return EOK;
+}
+
+/*
+ * API to select the member of a flow.
+ * refer lpm.h for details.
+ */
+const nh_member*
+nhg_select(const nh_group *group, unsigned int flow_hash)
+{
+    if (group == NULL || group->nmembers == 0) {
+        return NULL;
+    }
+
+    return &group->member[group->bucket[flow_hash % NHG_BUCKETS]];
+}
+
+/*
+ * API to perform the nexthop group operations requested by the user.
+ * refer lpm.h for details.
+ */
+void
+nhg_menu(lkp_result *result)
+{
+    char user_data;
+    char ip[IPv4_SIZE];
+    int id = 0;
+    int nw_ip = 0;
+    int port = 0;
+    int rc = 0;
+    nh_group *group = NULL;
+
+    (void)memset(ip, '\0',  IPv4_SIZE*sizeof(char));
+
+    printf("Group: [c]reate, [a]dd member, [d]elete member, [r]emove or [l]ookup flow: ");
+    scanf(" %c",&user_data);
+
+    switch (user_data) {
+        case 'c':
+        case 'C':
+            printf("Enter the group id: ");
+            scanf("%d",&id);
+            if (nhg_create(id) != NULL) {
+                printf("Nexthop group %d created.\n", id);
+            }
+            break;
+
+        case 'a':
+        case 'A':
+        case 'd':
+        case 'D':
+            printf("Enter the group id: ");
+            scanf("%d",&id);
+            printf("Enter the IPv4 nextop ip: ");
+            scanf("%15s",ip);
+            printf("Enter the o/p port: ");
+            scanf("%d",&port);
+
+            group = nhg_find(id);
+            if (group == NULL) {
+                printf("Invalid nexthop group: %d\n", id);
+                break;
+            }
+            if (inet_pton(AF_INET, ip, &nw_ip) != 1) {
+                printf("Invalid IPv4 nexthop address: %s\n", ip);
+                break;
+            }
+            nw_ip = ntohl(nw_ip);
+
+            if (user_data == 'a' || user_data == 'A') {
+                rc = nhg_add_member(group, nw_ip, port);
+            } else {
+                rc = nhg_del_member(group, nw_ip, port);
+            }
+            if (rc != EOK) {
+                printf("Nexthop group %d update failed. rc = %d\n", id, rc);
+                break;
+            }
+            printf("Nexthop group %d has %d members.\n", id, group->nmembers);
+
+            /* routes using the group changed, update the registered ip */
+            cache = FALSE;
+            (void)update_reg_ip(result);
+            break;
+
+        case 'r':
+        case 'R':
+            printf("Enter the group id: ");
+            scanf("%d",&id);
+            if (nhg_destroy(id) == EOK) {
+                printf("Nexthop group %d removed.\n", id);
+            }
+            break;
+
+        case 'l':
+        case 'L': {
+            int prefix[MAX_DEPTH];
+            unsigned int flow_hash = 0;
+            lkp_result flow;
+
+            printf("IPv4 address to search: ");
+            scanf("%15s",ip);
+            printf("Enter the flow hash: ");
+            scanf("%u",&flow_hash);
+            if (inet_pton(AF_INET, ip, &nw_ip) != 1) {
+                printf("Invalid IPv4 address: %s\n", ip);
+                break;
+            }
+            (void)memset(prefix, -1, MAX_DEPTH*sizeof(int));
+            (void)memset(&flow, 0, sizeof(flow));
+            (void)dec2bin(ntohl(nw_ip), prefix, MAX_DEPTH);
+
+            /* lookup for a flow, the registered ip cache stays as is */
+            rc = cache;
+            if (find_route_ecmp(prefix, flow_hash, &flow) == EOK) {
+                int nw_nh = htonl(flow.nh);
+                inet_ntop(AF_INET, &nw_nh, ip, IPv4_SIZE);
+                printf("Flow Nexthop %s\n",ip);
+                printf("Source Port %d\n",flow.sp);
+            }
+            cache = rc;
+            break;
+        }
+
+        default:
+            printf("Invalid Input.\n");
+            break;
+    }
+}
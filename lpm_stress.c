@@ -0,0 +1,917 @@
+/******************************************************************************
+LPM differential stress test
+
+Functions to :
+apply the same random route churn to every IPv4 lookup engine
+check every answer against a linear scan over the routes (the oracle)
+shrink the first mismatch of an engine down to a short reproducer
+measure the throughput of the engines on the same operations
+
+Engines:
+trie        - the binary LPM tree, compacted at every walk
+mbt 16-8-8  - multibit trie with a fixed layout
+mbt tuned   - multibit trie with its layout tuned in the background
+
+*******************************************************************************/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./lpm.h"
+
+
+/*
+ * operations of the stress test
+ */
+ #define STRESS_ADD      0
+ #define STRESS_DELETE   1
+ #define STRESS_LOOKUP   2
+ #define STRESS_WALK     3      //compare the whole routing table
+
+ #define STRESS_BATCH    4096   //operations timed at once, the last one walks
+ #define STRESS_REPLAYS  2000   //replays spent on shrinking a mismatch
+
+
+extern lpm_node *root;
+extern int cache;
+extern lpm_arena arena;
+
+typedef struct stress_op {
+    int type;
+    int route;                  //index of the route (add/delete)
+    unsigned int addr;          //address to search (lookup)
+    int nexthop;                //nexthop to add
+    int port;                   //port to add
+} stress_op;
+
+typedef struct stress_engine stress_engine;
+
+struct stress_engine {
+    const char *name;
+    void (*create)(stress_engine *e);
+    void (*destroy)(stress_engine *e);
+    void (*add)(stress_engine *e, const lpm_route *route);
+    void (*del)(stress_engine *e, const lpm_route *route);
+    void (*lookup)(stress_engine *e, unsigned int addr, int *nh, int *port);
+    int  (*walk)(stress_engine *e, lpm_route *out);
+    mbt_table *mbt;             //multibit trie engines
+    stride_tuner *tuner;        //tuned multibit trie
+    int *nh;                    //lookup answers of the current batch
+    int *port;
+    lpm_route *routes;          //routes of the last walk
+    int nroutes;
+    double secs;                //time spent on the operations
+    double lkp_secs;            //time spent on the lookup only pass
+    int mismatches;
+    int first_bad;              //first operation with a wrong answer
+};
+
+/* routes the operations draw from, sorted by prefix then length */
+static lpm_route *pool;
+static int npool;
+static char *live;              //TRUE if the oracle holds the route
+
+static unsigned int stress_state;   //random generator
+
+
+/*
+ * xorshift random generator, the same seed gives the same operations
+ */
+static unsigned int
+stress_rand(void)
+{
+    stress_state ^= stress_state << 13;
+    stress_state ^= stress_state >> 17;
+    stress_state ^= stress_state << 5;
+    return stress_state;
+}
+
+/*
+ * Mask of the first 'len' bits of an address
+ */
+static inline unsigned int
+stress_mask(int len)
+{
+    return len ? ~0u << (MAX_DEPTH - len) : 0;
+}
+
+static double
+stress_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Routes in the order the tree iterator returns them
+ */
+static int
+stress_route_cmp(const void *a, const void *b)
+{
+    const lpm_route *ra = a;
+    const lpm_route *rb = b;
+
+    if (ra->prefix != rb->prefix) {
+        return ra->prefix < rb->prefix ? -1 : 1;
+    }
+    return ra->len - rb->len;
+}
+
+/*
+ * Address in the byte layout of the multibit trie
+ */
+static inline void
+stress_bytes(unsigned int addr, unsigned char *bytes)
+{
+    (void)memset(bytes, 0, IPv6_BYTES);
+    bytes[0] = addr >> 24;
+    bytes[1] = addr >> 16;
+    bytes[2] = addr >> 8;
+    bytes[3] = addr;
+}
+
+static inline void
+stress_default(int *nh, int *port)
+{
+    *nh = 2130706433;           //local host 127.0.0.1
+    *port = 999;                //CPU port
+}
+
+/*
+ * BINARY TRIE ENGINE
+ */
+static void
+trie_create(stress_engine *e)
+{
+    lpm_node *node = lpm_node_alloc();
+
+    (void)e;
+    fill_data(&node, -1, -1, -1);
+    root = node;
+}
+
+static void
+trie_destroy(stress_engine *e)
+{
+    lpm_node *stack[2*MAX_DEPTH+2];
+    int top = 0;
+
+    (void)e;
+    lpm_compact_wait();
+
+    stack[top++] = root;
+    while (top > 0) {
+        lpm_node *node = stack[--top];
+        if (node->left != NULL) {
+            stack[top++] = node->left;
+        }
+        if (node->right != NULL) {
+            stack[top++] = node->right;
+        }
+        lpm_node_free(node);
+    }
+    free(arena.slab);
+    (void)memset(&arena, 0, sizeof(arena));
+    root = NULL;
+}
+
+static void
+trie_add(stress_engine *e, const lpm_route *route)
+{
+    int prefix[MAX_DEPTH];
+
+    (void)e;
+    (void)dec2bin(route->prefix >> (MAX_DEPTH - route->len), prefix,
+                  route->len);
+    (void)insert_prefix(prefix, route->len, route->nexthop, route->src_port);
+}
+
+static void
+trie_del(stress_engine *e, const lpm_route *route)
+{
+    int prefix[MAX_DEPTH];
+
+    (void)e;
+    (void)dec2bin(route->prefix >> (MAX_DEPTH - route->len), prefix,
+                  route->len);
+    (void)delete_prefix(root, prefix, route->len);
+}
+
+static void
+trie_lookup(stress_engine *e, unsigned int addr, int *nh, int *port)
+{
+    int prefix[MAX_DEPTH];
+    lkp_result result;
+
+    (void)e;
+    (void)dec2bin(addr, prefix, MAX_DEPTH);
+    if (find_route(prefix, &result) != EOK) {
+        *nh = -1;
+        *port = -1;
+        return;
+    }
+    *nh = result.nh;
+    *port = result.sp;
+}
+
+static int
+trie_walk(stress_engine *e, lpm_route *out)
+{
+    lpm_iter iter;
+    int n = 0;
+
+    (void)e;
+
+    /* the walk also checks the compacted copy of the tree */
+    if (lpm_compact_start() == EOK) {
+        lpm_compact_wait();
+    }
+
+    if (lpm_iter_init(&iter, root, LPM_ITER_ALL, 0, 0) != EOK) {
+        return 0;
+    }
+    while (n <= npool && lpm_iter_next(&iter, &out[n])) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * MULTIBIT TRIE ENGINES
+ */
+static void
+mbt_engine_create(stress_engine *e)
+{
+    int stride[] = {16, 8, 8};
+
+    e->mbt = mbt_create(MAX_DEPTH, stride, sizeof(stride)/sizeof(int));
+    if (e->mbt == NULL) {
+        printf("IPv4 multibit trie init failed.\n");
+        exit(0);
+    }
+}
+
+static void
+mbt_tuned_create(stress_engine *e)
+{
+    mbt_engine_create(e);
+
+    e->tuner = calloc(1, sizeof(stride_tuner));
+    if (e->tuner == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+    stride_tuner_init(e->tuner, &e->mbt, STRIDE_BUDGET);
+}
+
+/*
+ * Wait for a rebuild of the tuned table and swap it in,
+ * so the answers only depend on the operations.
+ */
+static void
+mbt_engine_sync(stress_engine *e)
+{
+    if (e->tuner == NULL) {
+        return;
+    }
+    while (atomic_load(&e->tuner->state) == STRIDE_RUNNING) {
+        sched_yield();
+    }
+    stride_tuner_poll(e->tuner);
+}
+
+static void
+mbt_engine_destroy(stress_engine *e)
+{
+    mbt_engine_sync(e);
+    free(e->tuner);
+    e->tuner = NULL;
+    mbt_destroy(e->mbt);
+    e->mbt = NULL;
+}
+
+static void
+mbt_engine_add(stress_engine *e, const lpm_route *route)
+{
+    unsigned char prefix[IPv6_BYTES];
+    unsigned char nh[IPv6_BYTES];
+
+    stress_bytes(route->prefix, prefix);
+    stress_bytes(route->nexthop, nh);
+    if (mbt_insert(e->mbt, prefix, route->len, nh, route->src_port) == EOK &&
+        e->tuner != NULL) {
+        stride_tuner_update(e->tuner, TRUE, prefix, route->len, nh,
+                            route->src_port);
+    }
+}
+
+static void
+mbt_engine_del(stress_engine *e, const lpm_route *route)
+{
+    unsigned char prefix[IPv6_BYTES];
+
+    stress_bytes(route->prefix, prefix);
+    if (mbt_delete(e->mbt, prefix, route->len) == EOK && e->tuner != NULL) {
+        stride_tuner_update(e->tuner, FALSE, prefix, route->len, NULL, 0);
+    }
+}
+
+static void
+mbt_engine_lookup(stress_engine *e, unsigned int addr, int *nh, int *port)
+{
+    unsigned char bytes[IPv6_BYTES];
+    const mbt_route *rt = NULL;
+
+    stress_bytes(addr, bytes);
+    rt = mbt_lookup(e->mbt, bytes);
+    if (rt == NULL) {
+        stress_default(nh, port);
+        return;
+    }
+    *nh = (int)((unsigned int)rt->nexthop[0] << 24 | rt->nexthop[1] << 16 |
+                rt->nexthop[2] << 8 | rt->nexthop[3]);
+    *port = rt->src_port;
+}
+
+static int
+mbt_engine_walk(stress_engine *e, lpm_route *out)
+{
+    mbt_route *snap = NULL;
+    int n = 0;
+
+    mbt_engine_sync(e);
+
+    snap = malloc((e->mbt->nroutes + 1) * sizeof(mbt_route));
+    if (snap == NULL) {
+        printf("malloc failed.\n");
+        exit(0);
+    }
+    n = mbt_collect(e->mbt, snap);
+    if (n > npool + 1) {
+        n = npool + 1;
+    }
+    for (int i=0; i<n; i++) {
+        out[i].prefix = (unsigned int)snap[i].prefix[0] << 24 |
+                        snap[i].prefix[1] << 16 | snap[i].prefix[2] << 8 |
+                        snap[i].prefix[3];
+        out[i].len = snap[i].len;
+        out[i].nexthop = (int)((unsigned int)snap[i].nexthop[0] << 24 |
+                               snap[i].nexthop[1] << 16 |
+                               snap[i].nexthop[2] << 8 | snap[i].nexthop[3]);
+        out[i].src_port = snap[i].src_port;
+        out[i].group = 0;
+    }
+    free(snap);
+
+    qsort(out, n, sizeof(lpm_route), stress_route_cmp);
+    return n;
+}
+
+static stress_engine engines[] = {
+    { .name = "trie", .create = trie_create, .destroy = trie_destroy,
+      .add = trie_add, .del = trie_del, .lookup = trie_lookup,
+      .walk = trie_walk },
+    { .name = "mbt 16-8-8", .create = mbt_engine_create,
+      .destroy = mbt_engine_destroy, .add = mbt_engine_add,
+      .del = mbt_engine_del, .lookup = mbt_engine_lookup,
+      .walk = mbt_engine_walk },
+    { .name = "mbt tuned", .create = mbt_tuned_create,
+      .destroy = mbt_engine_destroy, .add = mbt_engine_add,
+      .del = mbt_engine_del, .lookup = mbt_engine_lookup,
+      .walk = mbt_engine_walk },
+};
+
+ #define STRESS_ENGINES  ((int)(sizeof(engines)/sizeof(engines[0])))
+
+
+/*
+ * Pick the routes: random prefixes of any length, half of them
+ * more specifics of an earlier route so deletes hit interior nodes.
+ */
+static void
+stress_pool(int n)
+{
+    pool = calloc(n, sizeof(lpm_route));
+    live = calloc(n, sizeof(char));
+    if (pool == NULL || live == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+
+    for (int i=0; i<n; i++) {
+        lpm_route *route = &pool[i];
+        const lpm_route *parent = i ? &pool[stress_rand() % i] : NULL;
+
+        if (parent != NULL && parent->len < MAX_DEPTH && stress_rand() % 2) {
+            int room = MAX_DEPTH - parent->len;
+            route->len = parent->len + 1 + stress_rand() % (room < 8 ? room : 8);
+            route->prefix = parent->prefix | (stress_rand() & ~stress_mask(parent->len));
+        } else {
+            route->len = stress_rand() % 2 ? 8 * (1 + stress_rand() % 3) :
+                                             1 + stress_rand() % MAX_DEPTH;
+            route->prefix = stress_rand();
+        }
+        route->prefix &= stress_mask(route->len);
+    }
+
+    /* sort and drop the duplicates */
+    qsort(pool, n, sizeof(lpm_route), stress_route_cmp);
+    npool = 0;
+    for (int i=0; i<n; i++) {
+        if (npool == 0 || stress_route_cmp(&pool[npool-1], &pool[i]) != 0) {
+            pool[npool++] = pool[i];
+        }
+    }
+}
+
+/*
+ * Random operations: 35% add, 20% delete, the rest lookups.
+ * The last operation of every batch walks the routing table.
+ */
+static stress_op*
+stress_ops(int n)
+{
+    stress_op *ops = calloc(n, sizeof(stress_op));
+
+    if (ops == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+
+    for (int i=0; i<n; i++) {
+        stress_op *op = &ops[i];
+        int pick = stress_rand() % 100;
+
+        op->route = stress_rand() % npool;
+        if (i % STRESS_BATCH == STRESS_BATCH - 1 || i == n - 1) {
+            op->type = STRESS_WALK;
+        } else if (pick < 35) {
+            op->type = STRESS_ADD;
+            do {
+                /* -1 is 255.255.255.255, the tree keeps it for no route */
+                op->nexthop = stress_rand();
+            } while (op->nexthop == -1);
+            op->port = stress_rand() % 999;
+        } else if (pick < 55) {
+            op->type = STRESS_DELETE;
+        } else {
+            /* mostly inside a route, sometimes anywhere */
+            op->type = STRESS_LOOKUP;
+            op->addr = stress_rand();
+            if (stress_rand() % 5) {
+                const lpm_route *route = &pool[op->route];
+                op->addr = route->prefix | (op->addr & ~stress_mask(route->len));
+            }
+        }
+    }
+
+    return ops;
+}
+
+/*
+ * Apply an operation to the oracle, lookups scan all the routes.
+ */
+static void
+oracle_apply(const stress_op *op, int *nh, int *port)
+{
+    int best = -1;
+
+    switch (op->type) {
+        case STRESS_ADD:
+            live[op->route] = TRUE;
+            pool[op->route].nexthop = op->nexthop;
+            pool[op->route].src_port = op->port;
+            break;
+
+        case STRESS_DELETE:
+            live[op->route] = FALSE;
+            break;
+
+        case STRESS_LOOKUP:
+            for (int i=0; i<npool; i++) {
+                if (live[i] && (best == -1 || pool[i].len > pool[best].len) &&
+                    ((op->addr ^ pool[i].prefix) & stress_mask(pool[i].len)) == 0) {
+                    best = i;
+                }
+            }
+            if (best == -1) {
+                stress_default(nh, port);
+            } else {
+                *nh = pool[best].nexthop;
+                *port = pool[best].src_port;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Apply an operation to an engine, the answer of a lookup goes to
+ * nh/port, the routes of a walk to the engine walk buffer.
+ */
+static inline void
+stress_apply(stress_engine *e, const stress_op *op, int *nh, int *port)
+{
+    switch (op->type) {
+        case STRESS_ADD: {
+            lpm_route route = pool[op->route];
+            route.nexthop = op->nexthop;
+            route.src_port = op->port;
+            e->add(e, &route);
+            break;
+        }
+
+        case STRESS_DELETE:
+            e->del(e, &pool[op->route]);
+            break;
+
+        case STRESS_LOOKUP:
+            e->lookup(e, op->addr, nh, port);
+            break;
+
+        default:
+            e->nroutes = e->walk(e, e->routes);
+            break;
+    }
+}
+
+/*
+ * Compare the walk of an engine with the routes of the oracle.
+ * Returns the index of the first wrong route, -1 if they match.
+ */
+static int
+stress_walk_diff(const stress_engine *e)
+{
+    int n = 0;
+
+    for (int i=0; i<npool; i++) {
+        if (!live[i]) {
+            continue;
+        }
+        if (n == e->nroutes ||
+            e->routes[n].prefix != pool[i].prefix ||
+            e->routes[n].len != pool[i].len ||
+            e->routes[n].nexthop != pool[i].nexthop ||
+            e->routes[n].src_port != pool[i].src_port) {
+            return n;
+        }
+        n++;
+    }
+
+    return n == e->nroutes ? -1 : n;
+}
+
+static void
+stress_print_route(const char *what, const lpm_route *route)
+{
+    char ip[IPv4_SIZE];
+    char nh[IPv4_SIZE];
+    unsigned int nw_ip = htonl(route->prefix);
+    unsigned int nw_nh = htonl(route->nexthop);
+
+    inet_ntop(AF_INET, &nw_ip, ip, IPv4_SIZE);
+    inet_ntop(AF_INET, &nw_nh, nh, IPv4_SIZE);
+    printf("  %s %s/%d", what, ip, route->len);
+    if (route->src_port >= 0) {
+        printf(" nexthop %s port %d", nh, route->src_port);
+    }
+    printf("\n");
+}
+
+static void
+stress_print_answer(const char *what, int nexthop, int port)
+{
+    char nh[IPv4_SIZE];
+    unsigned int nw_nh = htonl(nexthop);
+
+    inet_ntop(AF_INET, &nw_nh, nh, IPv4_SIZE);
+    printf("  %s nexthop %s port %d\n", what, nh, port);
+}
+
+/*
+ * Replay the operations in 'list' on a new instance of the engine.
+ * Returns TRUE if the engine and the oracle disagree on the last one.
+ * With 'verbose' the operations and both answers are printed.
+ */
+static int
+stress_replay(stress_engine *e, const stress_op *ops, const int *list, int n,
+              int verbose)
+{
+    int nh = 0, port = 0;
+    int exp_nh = 0, exp_port = 0;
+    int fails = FALSE;
+
+    (void)memset(live, 0, npool*sizeof(char));
+    e->create(e);
+
+    for (int i=0; i<n; i++) {
+        const stress_op *op = &ops[list[i]];
+        lpm_route route = pool[op->route];
+
+        stress_apply(e, op, &nh, &port);
+        oracle_apply(op, &exp_nh, &exp_port);
+
+        if (verbose) {
+            if (op->type == STRESS_ADD) {
+                route.nexthop = op->nexthop;
+                route.src_port = op->port;
+                stress_print_route("add", &route);
+            } else if (op->type == STRESS_DELETE) {
+                route.src_port = -1;
+                stress_print_route("delete", &route);
+            } else if (op->type == STRESS_LOOKUP) {
+                char ip[IPv4_SIZE];
+                unsigned int nw_ip = htonl(op->addr);
+                inet_ntop(AF_INET, &nw_ip, ip, IPv4_SIZE);
+                printf("  lookup %s\n", ip);
+            } else {
+                printf("  walk\n");
+            }
+        }
+    }
+
+    if (n > 0 && ops[list[n-1]].type == STRESS_LOOKUP) {
+        fails = nh != exp_nh || port != exp_port;
+        if (verbose) {
+            stress_print_answer("got", nh, port);
+            stress_print_answer("expected", exp_nh, exp_port);
+        }
+    } else if (n > 0 && ops[list[n-1]].type == STRESS_WALK) {
+        int diff = stress_walk_diff(e);
+        fails = diff != -1;
+        if (verbose && fails) {
+            int expected = 0;
+            for (int i=0; i<npool; i++) {
+                if (live[i] && expected++ == diff) {
+                    stress_print_route("expected route", &pool[i]);
+                }
+            }
+            if (diff < e->nroutes) {
+                stress_print_route("got route", &e->routes[diff]);
+            }
+            printf("  got %d routes, expected %d\n", e->nroutes, expected);
+        }
+    }
+
+    e->destroy(e);
+
+    return fails;
+}
+
+/*
+ * Shrink the operations up to the first mismatch of an engine:
+ * keep only the routes covering the failing lookup if that still fails,
+ * then drop chunks of operations as long as the mismatch stays.
+ * The failing operation is always kept last.
+ */
+static void
+stress_shrink(stress_engine *e, const stress_op *ops)
+{
+    const stress_op *bad = &ops[e->first_bad];
+    int *list = NULL;
+    int *trial = NULL;
+    int n = 0;
+    int replays = 0;
+
+    list = calloc(e->first_bad + 1, sizeof(int));
+    trial = calloc(e->first_bad + 1, sizeof(int));
+    if (list == NULL || trial == NULL) {
+        printf("calloc failed.\n");
+        exit(0);
+    }
+
+    if (bad->type == STRESS_LOOKUP) {
+        for (int i=0; i<e->first_bad; i++) {
+            const lpm_route *route = &pool[ops[i].route];
+            if ((ops[i].type == STRESS_ADD || ops[i].type == STRESS_DELETE) &&
+                ((bad->addr ^ route->prefix) & stress_mask(route->len)) == 0) {
+                list[n++] = i;
+            }
+        }
+        list[n++] = e->first_bad;
+        replays++;
+        if (!stress_replay(e, ops, list, n, FALSE)) {
+            n = 0;
+        }
+    }
+    if (n == 0) {
+        for (int i=0; i<=e->first_bad; i++) {
+            list[n++] = i;
+        }
+    }
+
+    for (int chunk = (n - 1) / 2; chunk >= 1; chunk /= 2) {
+        for (int start=0; start < n - 1 && replays < STRESS_REPLAYS; ) {
+            int end = start + chunk < n - 1 ? start + chunk : n - 1;
+            int m = 0;
+
+            for (int i=0; i<n; i++) {
+                if (i < start || i >= end) {
+                    trial[m++] = list[i];
+                }
+            }
+            replays++;
+            if (stress_replay(e, ops, trial, m, FALSE)) {
+                (void)memcpy(list, trial, m*sizeof(int));
+                n = m;
+            } else {
+                start = end;
+            }
+        }
+    }
+
+    printf("Reproducer for %s, %d of %d operations%s:\n", e->name, n,
+           e->first_bad + 1, replays < STRESS_REPLAYS ? "" : " (not minimal)");
+    if (!stress_replay(e, ops, list, n, TRUE)) {
+        printf("  mismatch did not reproduce on replay\n");
+    }
+
+    free(list);
+    free(trial);
+}
+
+/*
+ * API to run the differential stress test.
+ * refer lpm.h for details.
+ */
+int
+lpm_stress(int nops, int nroutes, unsigned int seed)
+{
+    lpm_node *saved_root = NULL;
+    lpm_arena saved_arena;
+    int saved_cache = 0;
+    stress_op *ops = NULL;
+    int exp_nh = 0, exp_port = 0;
+    int total = 0;
+    long nlookups = 0;
+    long ntimed = 0;
+    volatile unsigned int sink = 0;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (nops < 1 || nroutes < 1) {
+        printf("Invalid parameter ops %d routes %d\n", nops, nroutes);
+        return EINVAL;
+    }
+
+    /*
+     * The trie engine works on the global tree, park the user's tree
+     */
+    lpm_compact_wait();
+    saved_root = root;
+    saved_arena = arena;
+    saved_cache = cache;
+    (void)memset(&arena, 0, sizeof(arena));
+
+    stress_state = seed ? seed : 1;
+    stress_pool(nroutes);
+    ops = stress_ops(nops);
+
+    for (int k=0; k<STRESS_ENGINES; k++) {
+        stress_engine *e = &engines[k];
+        e->nh = calloc(STRESS_BATCH, sizeof(int));
+        e->port = calloc(STRESS_BATCH, sizeof(int));
+        e->routes = calloc(npool + 1, sizeof(lpm_route));
+        if (e->nh == NULL || e->port == NULL || e->routes == NULL) {
+            printf("calloc failed.\n");
+            exit(0);
+        }
+        e->secs = 0;
+        e->lkp_secs = 0;
+        e->mismatches = 0;
+        e->first_bad = -1;
+        e->create(e);
+    }
+    (void)memset(live, 0, npool*sizeof(char));
+
+    printf("Stress test: %d operations on %d routes, seed %u\n",
+                                            nops, npool, seed);
+
+    /*
+     * RUN THE OPERATIONS BATCH BY BATCH,
+     * every engine is timed on the whole batch, then checked
+     */
+    for (int base=0; base<nops; base+=STRESS_BATCH) {
+        int end = base + STRESS_BATCH < nops ? base + STRESS_BATCH : nops;
+
+        for (int k=0; k<STRESS_ENGINES; k++) {
+            stress_engine *e = &engines[k];
+            double start = stress_now();
+            for (int i=base; i<end; i++) {
+                if (ops[i].type == STRESS_WALK) {
+                    /* checking aid, left out of the timing */
+                    e->secs += stress_now() - start;
+                    stress_apply(e, &ops[i], NULL, NULL);
+                    start = stress_now();
+                    continue;
+                }
+                stress_apply(e, &ops[i], &e->nh[i-base], &e->port[i-base]);
+            }
+            e->secs += stress_now() - start;
+        }
+
+        for (int i=base; i<end; i++) {
+            ntimed += ops[i].type != STRESS_WALK;
+            oracle_apply(&ops[i], &exp_nh, &exp_port);
+            for (int k=0; k<STRESS_ENGINES; k++) {
+                stress_engine *e = &engines[k];
+                int bad = FALSE;
+                if (ops[i].type == STRESS_LOOKUP) {
+                    bad = e->nh[i-base] != exp_nh || e->port[i-base] != exp_port;
+                } else if (ops[i].type == STRESS_WALK) {
+                    bad = stress_walk_diff(e) != -1;
+                }
+                if (bad) {
+                    e->mismatches++;
+                    if (e->first_bad == -1) {
+                        e->first_bad = i;
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+     * LOOKUP ONLY PASS on the final tables
+     */
+    for (int k=0; k<STRESS_ENGINES; k++) {
+        stress_engine *e = &engines[k];
+        double start = stress_now();
+        nlookups = 0;
+        for (int i=0; i<nops; i++) {
+            if (ops[i].type == STRESS_LOOKUP) {
+                int nh = 0, port = 0;
+                e->lookup(e, ops[i].addr, &nh, &port);
+                sink += (unsigned int)nh;
+                nlookups++;
+            }
+        }
+        e->lkp_secs = stress_now() - start;
+        e->destroy(e);
+    }
+
+    printf("%-12s %14s %14s %12s\n", "engine", "ops/s", "lookups/s",
+                                                    "mismatches");
+    for (int k=0; k<STRESS_ENGINES; k++) {
+        stress_engine *e = &engines[k];
+        printf("%-12s %14.0f %14.0f %12d\n", e->name,
+               e->secs > 0 ? ntimed / e->secs : 0,
+               e->lkp_secs > 0 ? nlookups / e->lkp_secs : 0,
+               e->mismatches);
+        total += e->mismatches;
+    }
+
+    for (int k=0; k<STRESS_ENGINES; k++) {
+        if (engines[k].first_bad != -1) {
+            stress_shrink(&engines[k], ops);
+        }
+    }
+
+    for (int k=0; k<STRESS_ENGINES; k++) {
+        free(engines[k].nh);
+        free(engines[k].port);
+        free(engines[k].routes);
+    }
+    free(ops);
+    free(pool);
+    free(live);
+    pool = NULL;
+    live = NULL;
+
+    root = saved_root;
+    arena = saved_arena;
+    cache = saved_cache;
+
+    return total;
+}
+
+/*
+ * API to get the stress test parameters from the user.
+ * refer lpm.h for details.
+ */
+void
+stress_menu(void)
+{
+    int nops = 0;
+    int nroutes = 0;
+    unsigned int seed = 0;
+
+    printf("Enter the number of operations: ");
+    scanf("%d",&nops);
+    printf("Enter the number of routes: ");
+    scanf("%d",&nroutes);
+    printf("Enter the random seed: ");
+    scanf("%u",&seed);
+
+    if (lpm_stress(nops, nroutes, seed) == EOK) {
+        printf("All engines match the oracle.\n");
+    }
+}
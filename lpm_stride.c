@@ -0,0 +1,513 @@
+/******************************************************************************
+Adaptive stride selection
+
+Functions to :
+compute the stride layout of a multibit trie from the routes it holds
+rebuild the trie in the background when the prefix lengths drift
+
+The layout is chosen with controlled prefix expansion: a level starting at
+depth m with stride s costs one node of 2^s slots for every one bit trie
+node at depth m. For every number of levels the cheapest layout is found
+by dynamic programming, the one with the fewest levels that fits in the
+memory budget is used.
+
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./lpm.h"
+
+
+ #define STRIDE_INF 1e300
+
+
+/*
+ * qsort callback, orders routes by prefix bits.
+ */
+static int
+stride_cmp(const void *a, const void *b)
+{
+    const mbt_route *ra = *(const mbt_route * const *)a;
+    const mbt_route *rb = *(const mbt_route * const *)b;
+
+    return memcmp(ra->prefix, rb->prefix, IPv6_BYTES);
+}
+
+/*
+ * Number of leading bits two prefixes have in common.
+ */
+static int
+stride_common(const unsigned char *a, const unsigned char *b)
+{
+    int i = 0;
+
+    while (i < IPv6_BYTES && a[i] == b[i]) {
+        i++;
+    }
+    if (i == IPv6_BYTES) {
+        return MAX_DEPTH6;
+    }
+
+    return i * 8 + __builtin_clz((unsigned int)(a[i] ^ b[i]) << 24);
+}
+
+/*
+ * Fill the access statistics of a layout from a prefix length histogram.
+ */
+static void
+stride_accesses(stride_plan *plan, const int *len_count, int width)
+{
+    int level = 0;
+    int end = plan->stride[0];
+    int total = 0;
+    double sum = 0;
+
+    plan->max_accesses = 0;
+    for (int len=1; len<=width; len++) {
+        while (len > end) {
+            end += plan->stride[++level];
+        }
+        if (len_count[len]) {
+            total += len_count[len];
+            sum += (double)len_count[len] * (level + 1);
+            plan->max_accesses = level + 1;
+        }
+    }
+    plan->accesses = total ? sum / total : 0;
+}
+
+/*
+ * API to compute the stride layout of a set of routes.
+ * refer lpm.h for details.
+ */
+int
+stride_plan_compute(const mbt_route *routes, int nroutes, int width,
+                    size_t budget, stride_plan *plan)
+{
+    const mbt_route **sorted = NULL;    //routes ordered by prefix
+    int *common = NULL;                 //bits shared with the previous route
+    double nodes[MAX_DEPTH6+1];         //one bit trie nodes at each depth
+    int len_count[MAX_DEPTH6+1];
+    double (*cost)[MAX_DEPTH6+1] = NULL;  //[levels][depth]
+    int (*from)[MAX_DEPTH6+1] = NULL;     //start of the last level
+    double base = 0;                    //memory used by the routes
+    int maxlen = 0;
+    int best = 0;
+    int rc = EOK;
+
+    /*
+     * VERIFY INPUT DATA
+     */
+    if (routes == NULL || nroutes < 1 || plan == NULL ||
+        width < 1 || width > MAX_DEPTH6) {
+        printf("Invalid parameter routes %p nroutes %d width %d plan %p\n",
+                                  routes, nroutes, width, plan);
+        return EINVAL;
+    }
+
+    (void)memset(len_count, 0, sizeof(len_count));
+    for (int i=0; i<nroutes; i++) {
+        len_count[routes[i].len]++;
+        if (routes[i].len > maxlen) {
+            maxlen = routes[i].len;
+        }
+    }
+
+    /*
+     * COUNT THE ONE BIT TRIE NODES AT EACH DEPTH
+     *
+     * A node at depth d exists for every distinct d bit prefix of the
+     * routes longer than d. Routes sharing d bits are adjacent once
+     * sorted, and the bits two routes share is the minimum shared by
+     * the routes in between.
+     */
+    sorted = malloc(nroutes * sizeof(mbt_route *));
+    common = malloc(nroutes * sizeof(int));
+    if (sorted == NULL || common == NULL) {
+        printf("malloc failed.\n");
+        exit(0);
+    }
+    for (int i=0; i<nroutes; i++) {
+        sorted[i] = &routes[i];
+    }
+    qsort(sorted, nroutes, sizeof(mbt_route *), stride_cmp);
+    for (int i=1; i<nroutes; i++) {
+        common[i] = stride_common(sorted[i-1]->prefix, sorted[i]->prefix);
+    }
+
+    nodes[0] = 1;
+    for (int d=1; d<maxlen; d++) {
+        int shared = 0;                 //bits shared with the last counted route
+        int first = TRUE;
+
+        nodes[d] = 0;
+        for (int i=0; i<nroutes; i++) {
+            if (i > 0 && common[i] < shared) {
+                shared = common[i];
+            }
+            if (sorted[i]->len > d) {
+                if (first || shared < d) {
+                    nodes[d]++;
+                }
+                first = FALSE;
+                shared = MAX_DEPTH6;
+            }
+        }
+    }
+    free(sorted);
+    free(common);
+
+    /*
+     * CHEAPEST LAYOUT FOR EVERY NUMBER OF LEVELS
+     *
+     * cost[r][j] - memory of r levels covering the first j bits
+     */
+    cost = malloc((MAX_DEPTH6+1) * sizeof(*cost));
+    from = calloc(MAX_DEPTH6+1, sizeof(*from));
+    if (cost == NULL || from == NULL) {
+        printf("malloc failed.\n");
+        exit(0);
+    }
+    for (int r=0; r<=maxlen; r++) {
+        for (int j=0; j<=maxlen; j++) {
+            cost[r][j] = STRIDE_INF;
+        }
+    }
+    cost[0][0] = 0;
+
+    for (int r=1; r<=maxlen; r++) {
+        for (int j=r; j<=maxlen; j++) {
+            int m = j > MBT_MAX_STRIDE ? j - MBT_MAX_STRIDE : 0;
+            for (; m<j; m++) {
+                double c;
+                if (cost[r-1][m] >= STRIDE_INF) {
+                    continue;
+                }
+                c = cost[r-1][m] + nodes[m] *
+                    (sizeof(mbt_node) + (double)(1u << (j-m)) * sizeof(mbt_entry));
+                if (c < cost[r][j]) {
+                    cost[r][j] = c;
+                    from[r][j] = m;
+                }
+            }
+        }
+    }
+
+    /*
+     * FEWEST LEVELS THAT FIT IN THE BUDGET
+     */
+    base = (double)nroutes * (sizeof(mbt_route) + sizeof(mbt_route *));
+    for (int r=1; r<=maxlen; r++) {
+        if (cost[r][maxlen] < STRIDE_INF &&
+            cost[r][maxlen] + base <= (double)budget) {
+            best = r;
+            break;
+        }
+    }
+    if (best == 0) {
+        /* nothing fits, use the smallest layout */
+        rc = EINVAL;
+        best = 1;
+        for (int r=1; r<=maxlen; r++) {
+            if (cost[r][maxlen] < cost[best][maxlen]) {
+                best = r;
+            }
+        }
+    }
+
+    (void)memset(plan, 0, sizeof(stride_plan));
+    plan->nlevels = best;
+    plan->mem = cost[best][maxlen] + base;
+    for (int r=best, j=maxlen; r>0; r--) {
+        plan->stride[r-1] = j - from[r][j];
+        j = from[r][j];
+    }
+    free(cost);
+    free(from);
+
+    /* levels for prefixes longer than the ones loaded */
+    for (int j=maxlen; j<width; j+=8) {
+        plan->stride[plan->nlevels++] = width - j < 8 ? width - j : 8;
+    }
+
+    stride_accesses(plan, len_count, width);
+
+    return rc;
+}
+
+/*
+ * API to build a multibit trie with a planned layout.
+ * refer lpm.h for details.
+ */
+mbt_table*
+stride_build(const mbt_route *routes, int nroutes, int width,
+             const stride_plan *plan)
+{
+    mbt_table *table = NULL;
+
+    if (routes == NULL || plan == NULL) {
+        printf("Invalid parameter routes %p plan %p\n", routes, plan);
+        return NULL;
+    }
+
+    table = mbt_create(width, plan->stride, plan->nlevels);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    for (int i=0; i<nroutes; i++) {
+        (void)mbt_insert(table, routes[i].prefix, routes[i].len,
+                         routes[i].nexthop, routes[i].src_port);
+    }
+
+    return table;
+}
+
+/*
+ * Remember the prefix length share the live layout is planned for.
+ */
+static void
+stride_tuner_mark(stride_tuner *tuner)
+{
+    mbt_table *table = *tuner->table;
+
+    for (int len=0; len<=MAX_DEPTH6; len++) {
+        tuner->hist[len] = table->nroutes ?
+                    (double)table->len_count[len] / table->nroutes : 0;
+    }
+    tuner->planned = table->nroutes;
+    tuner->changes = 0;
+}
+
+/*
+ * Background thread: plan the layout and build the table from the snapshot.
+ */
+static void*
+stride_tuner_main(void *arg)
+{
+    stride_tuner *tuner = arg;
+
+    tuner->next = NULL;
+    if (stride_plan_compute(tuner->snap, tuner->nsnap, tuner->width,
+                            tuner->budget, &tuner->next_plan) == EOK ||
+        tuner->next_plan.mem < (double)tuner->snap_mem) {
+        /* fits the budget, or else the smallest layout saves memory */
+        tuner->next = stride_build(tuner->snap, tuner->nsnap, tuner->width,
+                                   &tuner->next_plan);
+    }
+
+    atomic_store(&tuner->state, STRIDE_DONE);
+
+    return NULL;
+}
+
+/*
+ * API to attach a tuner to a table.
+ * refer lpm.h for details.
+ */
+void
+stride_tuner_init(stride_tuner *tuner, mbt_table **table, size_t budget)
+{
+    if (tuner == NULL || table == NULL || *table == NULL) {
+        printf("%s:%d Invalid Input Parameters\n", __FUNCTION__, __LINE__);
+        return;
+    }
+
+    (void)memset(tuner, 0, sizeof(stride_tuner));
+    tuner->table = table;
+    tuner->budget = budget;
+    tuner->width = (*table)->width;
+    atomic_init(&tuner->state, STRIDE_IDLE);
+
+    /* layout the table was created with */
+    tuner->plan.nlevels = (*table)->nlevels;
+    (void)memcpy(tuner->plan.stride, (*table)->stride, sizeof(tuner->plan.stride));
+    tuner->plan.mem = (double)(*table)->mem;
+    stride_accesses(&tuner->plan, (*table)->len_count, tuner->width);
+
+    stride_tuner_mark(tuner);
+}
+
+/*
+ * API to track the updates of a tuned table.
+ * refer lpm.h for details.
+ */
+void
+stride_tuner_update(stride_tuner *tuner, int add, const unsigned char *prefix,
+                    int len, const unsigned char *nexthop, int port)
+{
+    mbt_table *table = NULL;
+    double drift = 0;
+    int over = FALSE;
+
+    if (tuner == NULL || tuner->table == NULL || prefix == NULL) {
+        printf("%s:%d Invalid Input Parameters\n", __FUNCTION__, __LINE__);
+        return;
+    }
+    table = *tuner->table;
+
+    /*
+     * rebuild running, journal the update for the new table
+     */
+    if (atomic_load(&tuner->state) != STRIDE_IDLE) {
+        if (tuner->njournal >= 0 && tuner->njournal < STRIDE_JOURNAL) {
+            stride_update *u = &tuner->journal[tuner->njournal++];
+            (void)memset(u, 0, sizeof(stride_update));
+            u->add = add;
+            (void)memcpy(u->route.prefix, prefix, IPv6_BYTES);
+            u->route.len = len;
+            if (nexthop != NULL) {
+                (void)memcpy(u->route.nexthop, nexthop, IPv6_BYTES);
+            }
+            u->route.src_port = port;
+        } else {
+            /* too many updates, the rebuilt table is dropped */
+            tuner->njournal = -1;
+        }
+        return;
+    }
+
+    /*
+     * check the drift every few updates
+     */
+    tuner->changes++;
+    if (table->nroutes == 0 || tuner->changes < STRIDE_MIN_CHANGES ||
+        tuner->changes < table->nroutes / 16) {
+        return;
+    }
+    tuner->changes = 0;
+
+    for (int l=0; l<=MAX_DEPTH6; l++) {
+        double share = (double)table->len_count[l] / table->nroutes;
+        drift += share > tuner->hist[l] ? share - tuner->hist[l] :
+                                          tuner->hist[l] - share;
+    }
+    /* over the budget: try again only once the routes moved */
+    over = table->mem > tuner->budget &&
+           (!tuner->over_budget ||
+            abs(table->nroutes - tuner->planned) > tuner->planned / 16);
+
+    if (drift < STRIDE_DRIFT && !over &&
+        table->nroutes <= 2 * tuner->planned &&
+        2 * table->nroutes >= tuner->planned) {
+        return;
+    }
+
+    /*
+     * START THE REBUILD
+     */
+    tuner->snap = malloc(table->nroutes * sizeof(mbt_route));
+    if (tuner->snap == NULL) {
+        printf("malloc failed.\n");
+        exit(0);
+    }
+    tuner->nsnap = mbt_collect(table, tuner->snap);
+    tuner->snap_mem = table->mem;
+    tuner->njournal = 0;
+    atomic_store(&tuner->state, STRIDE_RUNNING);
+
+    if (pthread_create(&tuner->thread, NULL, stride_tuner_main, tuner) != 0) {
+        printf("Stride rebuild thread create failed.\n");
+        free(tuner->snap);
+        tuner->snap = NULL;
+        atomic_store(&tuner->state, STRIDE_IDLE);
+    }
+}
+
+/*
+ * API to swap in the rebuilt table.
+ * refer lpm.h for details.
+ */
+void
+stride_tuner_poll(stride_tuner *tuner)
+{
+    mbt_table *old = NULL;
+
+    if (tuner == NULL || atomic_load(&tuner->state) != STRIDE_DONE) {
+        return;
+    }
+
+    (void)pthread_join(tuner->thread, NULL);
+    free(tuner->snap);
+    tuner->snap = NULL;
+
+    if (tuner->next != NULL && tuner->njournal >= 0) {
+        /* replay the updates made during the rebuild */
+        for (int i=0; i<tuner->njournal; i++) {
+            stride_update *u = &tuner->journal[i];
+            if (u->add) {
+                (void)mbt_insert(tuner->next, u->route.prefix, u->route.len,
+                                 u->route.nexthop, u->route.src_port);
+            } else {
+                (void)mbt_delete(tuner->next, u->route.prefix, u->route.len);
+            }
+        }
+
+        old = *tuner->table;
+        *tuner->table = tuner->next;
+        mbt_destroy(old);
+
+        tuner->plan = tuner->next_plan;
+        stride_accesses(&tuner->plan, tuner->next->len_count, tuner->width);
+        tuner->over_budget = tuner->next->mem > tuner->budget;
+        stride_tuner_mark(tuner);
+    } else if (tuner->next != NULL) {
+        /* journal overflowed, rebuild again on the next drift check */
+        mbt_destroy(tuner->next);
+    } else {
+        /*
+         * no layout fits the budget and none is smaller than the live one:
+         * keep it, the plan now describes the live table
+         */
+        mbt_table *table = *tuner->table;
+        tuner->plan.nlevels = table->nlevels;
+        (void)memcpy(tuner->plan.stride, table->stride, sizeof(tuner->plan.stride));
+        tuner->plan.mem = (double)table->mem;
+        stride_accesses(&tuner->plan, table->len_count, tuner->width);
+        tuner->over_budget = TRUE;
+        stride_tuner_mark(tuner);
+    }
+
+    tuner->next = NULL;
+    tuner->njournal = 0;
+    atomic_store(&tuner->state, STRIDE_IDLE);
+}
+
+/*
+ * API to print the layout of a tuned table.
+ * refer lpm.h for details.
+ */
+void
+stride_report(stride_tuner *tuner)
+{
+    mbt_table *table = NULL;
+    stride_plan live;                   //layout of the live table
+
+    if (tuner == NULL || tuner->table == NULL) {
+        printf("%s:%d Invalid Input Parameters\n", __FUNCTION__, __LINE__);
+        return;
+    }
+    table = *tuner->table;
+
+    (void)memset(&live, 0, sizeof(live));
+    live.nlevels = table->nlevels;
+    (void)memcpy(live.stride, table->stride, sizeof(live.stride));
+    stride_accesses(&live, table->len_count, table->width);
+
+    printf("Routes %d, nodes %d, memory %zu bytes (budget %zu)\n",
+            table->nroutes, table->nnodes, table->mem, tuner->budget);
+    printf("Stride layout ");
+    for (int i=0; i<table->nlevels; i++) {
+        printf("%s%d", i ? "-" : "", table->stride[i]);
+    }
+    printf(" (planned for %d routes, estimated memory %.0f bytes)\n",
+            tuner->planned, tuner->plan.mem);
+    if (tuner->over_budget) {
+        printf("No layout fits the budget, the smallest one found is in use.\n");
+    }
+    printf("Expected accesses per lookup %.2f (worst case %d)\n",
+            live.accesses, live.max_accesses);
+    if (atomic_load(&tuner->state) != STRIDE_IDLE) {
+        printf("Rebuild in progress.\n");
+    }
+}
@@ -17,6 +17,9 @@ Date: 08/Jan/2022
 
 extern lpm_node *root;
 extern int cache;
+extern mbt_table *fib6;
+extern int cache6;
+extern stride_tuner tuner6;
 
 /*
  * API to initialise the global variables.
@@ -29,17 +32,23 @@ init_globals(void)
     cache = FALSE;
     
     /* alloc root node */
-    lpm_node *new_node = calloc(1,sizeof(lpm_node));
-    if (new_node == NULL) {
-        printf("calloc failed.\n");
-        exit(0);
-    }
+    lpm_node *new_node = lpm_node_alloc();
     new_node->val = -1;
     new_node->nexthop = -1;
     new_node->src_port = -1;
     new_node->left = NULL;
     new_node->right = NULL;
     root = new_node;
+
+    /* IPv6 table: 16 bit first stride, then 8 bit strides */
+    int stride6[] = {16, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8};
+    cache6 = FALSE;
+    fib6 = mbt_create(MAX_DEPTH6, stride6, sizeof(stride6)/sizeof(int));
+    if (fib6 == NULL) {
+        printf("IPv6 table init failed.\n");
+        exit(0);
+    }
+    stride_tuner_init(&tuner6, &fib6, STRIDE_BUDGET);
 }
 
 
@@ -75,7 +84,7 @@ dec2bin(unsigned int nw_ip, int *prefix, int size)
     /*
      * VERIFY INPUT DATA
      */
-    if (nw_ip == 0 || prefix == NULL || size == 0) {
+    if (prefix == NULL || size == 0) {
         printf("%s:%d Invalid PARAMETER. nw_ip %d prefix %p size %d\n",
                      __FUNCTION__, __LINE__, nw_ip, prefix, size);
         return;